@@ -10,8 +10,20 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#define aesd_alloc_slots(n, size) kvcalloc(n, size, GFP_KERNEL)
+#define aesd_free_slots(p) kvfree(p)
+#include <linux/uaccess.h>
+#define aesd_copy_out(dst, src, n) copy_to_user(dst, src, n)
 #else
 #include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#define aesd_alloc_slots(n, size) calloc(n, size)
+#define aesd_free_slots(p) free(p)
+#define aesd_copy_out(dst, src, n) (memcpy(dst, src, n), 0)
 #endif
 
 #include "aesd-circular-buffer.h"
@@ -29,58 +41,231 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    // find which entry the fpos maps to, wrt out_offs
-    struct aesd_buffer_entry * p_entry = NULL;
-    size_t current_string_size = 0;
-    uint8_t offset = buffer->out_offs;
-    do
+    uint64_t pos;
+    uint32_t low = 0;
+    uint32_t high;
+    uint32_t offset;
+
+    if (char_offset >= buffer->total_size)
+    {
+        return NULL;
+    }
+
+    // binary search for the newest entry starting at or before char_offset, wrt out_offs
+    pos = buffer->base_offset + char_offset;
+    high = buffer->count - 1;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low + 1) / 2;
+        if (buffer->start_offset[AESD_CIRCULAR_BUFFER_INDEX(buffer, mid)] <= pos)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+
+    offset = AESD_CIRCULAR_BUFFER_INDEX(buffer, low);
+    *entry_offset_byte_rtn = pos - buffer->start_offset[offset];
+    return &buffer->entry[offset];
+}
+
+/**
+ * Copies up to @param count bytes starting at @param char_offset of @param buffer to @param buf,
+ * across as many consecutive entries as fit, with a single offset lookup.
+ * Any necessary locking must be performed by caller.
+ * @return the number of bytes copied, 0 if char_offset is at or past the end of the buffer,
+ * or -EFAULT if nothing could be copied to buf
+ */
+ssize_t aesd_circular_buffer_copy_out(struct aesd_circular_buffer *buffer, size_t char_offset,
+            char __user *buf, size_t count)
+{
+    struct aesd_buffer_entry *p_entry;
+    size_t offset = 0;
+    size_t copied = 0;
+    uint32_t slot;
+
+    p_entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &offset);
+    if (NULL == p_entry)
+    {
+        return 0;
+    }
+
+    // the entries after the first one are contiguous slots up to the end of the buffer
+    if (count > buffer->total_size - char_offset)
+    {
+        count = buffer->total_size - char_offset;
+    }
+    slot = p_entry - buffer->entry;
+    while (copied < count)
     {
-        current_string_size += buffer->entry[offset].size;
-        // if char_offset is less that the current string size we have found the offset 
-        // in the buffer containt the char_offset
-        if (char_offset <= current_string_size - 1)
+        size_t bytes_to_copy = buffer->entry[slot].size - offset;
+        if (bytes_to_copy > count - copied)
         {
-            p_entry = &buffer->entry[offset];
+            bytes_to_copy = count - copied;
+        }
 
-            // to find entry_offset_byte_rtn we need the current_string_size before current 
-            // element was added to it, and then we can subtract that from char_offset
-            *entry_offset_byte_rtn = char_offset - (current_string_size - buffer->entry[offset].size);
-            break;
+        if (aesd_copy_out(buf + copied, &buffer->entry[slot].buffptr[offset], bytes_to_copy))
+        {
+            return (0 == copied) ? -EFAULT : (ssize_t)copied;
         }
-        offset = (offset + 1)%AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    } while (offset != buffer->in_offs);
+        copied += bytes_to_copy;
+        offset = 0;
+        slot = (slot + 1) & buffer->mask;
+    }
+    return copied;
+}
+
+/**
+ * @return the char_offset of the first byte of entry @param n of @param buffer,
+ * counted from 0 for the oldest entry, which must exist.
+ * Any necessary locking must be performed by caller.
+ */
+size_t aesd_circular_buffer_entry_char_offset(struct aesd_circular_buffer *buffer, uint32_t n)
+{
+    return buffer->start_offset[AESD_CIRCULAR_BUFFER_INDEX(buffer, n)] - buffer->base_offset;
+}
+
+/**
+ * @return true if the oldest entry of @param buffer has to go before an entry of
+ * @param add_size bytes can be added, because the buffer holds max_entries entries
+ * or would exceed its byte budget. An entry larger than the budget on its own
+ * only evicts every other entry.
+ */
+bool aesd_circular_buffer_must_evict(struct aesd_circular_buffer *buffer, size_t add_size)
+{
+    if (0 == buffer->count)
+    {
+        return false;
+    }
+    return buffer->full || ((0 != buffer->max_bytes) && (buffer->total_size + add_size > buffer->max_bytes));
+}
 
-    return p_entry;
+/**
+ * Removes the oldest entry of @param buffer, and stores it in @param removed unless NULL,
+ * so the caller can free the memory it references.
+ * Any necessary locking must be handled by the caller
+ * @return false if the buffer is empty
+ */
+bool aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed)
+{
+    struct aesd_buffer_entry *oldest;
+
+    if (0 == buffer->count)
+    {
+        return false;
+    }
+
+    oldest = &buffer->entry[buffer->out_offs];
+    if (NULL != removed)
+    {
+        *removed = *oldest;
+    }
+    buffer->total_size -= oldest->size;
+    buffer->base_offset += oldest->size;
+    // clear the slot, so AESD_CIRCULAR_BUFFER_FOREACH never sees a removed entry
+    oldest->buffptr = NULL;
+    oldest->size = 0;
+
+    buffer->out_offs = (buffer->out_offs + 1) & buffer->mask;
+    buffer->count--;
+    buffer->full = false;
+    return true;
 }
 
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
-* If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
-* new start location.
+* If the buffer was already full, or is over its byte budget, overwrites the oldest entries and
+* advances buffer->out_offs to the new start location. Callers owning the memory of the entries
+* remove them with aesd_circular_buffer_remove_oldest while aesd_circular_buffer_must_evict first.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
 */
 void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-   // write data
-    buffer->entry[buffer->in_offs] = *add_entry;
-    if (buffer->full)
+    while (aesd_circular_buffer_must_evict(buffer, add_entry->size))
     {
-        // if buffer is full, we have overwritten the oldest data, so update out_offs
-        buffer->out_offs = (buffer->out_offs + 1)%AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        aesd_circular_buffer_remove_oldest(buffer, NULL);
     }
 
+    // write data, it starts where the newest entry ends
+    buffer->entry[buffer->in_offs] = *add_entry;
+    buffer->start_offset[buffer->in_offs] = buffer->base_offset + buffer->total_size;
+    buffer->total_size += add_entry->size;
+    buffer->count++;
+
     // move in_offs to next location in buffer
-    buffer->in_offs = (buffer->in_offs + 1)%AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->in_offs = (buffer->in_offs + 1) & buffer->mask;
 
     // update full flag
-    buffer->full = (buffer->in_offs == buffer->out_offs)? true : false;
+    buffer->full = (buffer->count == buffer->max_entries) ? true : false;
 }
 
 /**
-* Initializes the circular buffer described by @param buffer to an empty struct
+* Initializes the circular buffer described by @param buffer to an empty struct, holding
+* up to AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries without a byte budget
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->default_entry;
+    buffer->start_offset = buffer->default_start_offset;
+    buffer->mask = AESDCHAR_DEFAULT_SLOTS - 1;
+    buffer->max_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct, holding up to
+* @param max_entries entries and @param max_bytes bytes, 0 for no byte budget. The slots are
+* max_entries rounded up to a power of two, allocated unless the default slots suffice.
+* @return 0, or -EINVAL if @param max_entries is 0 or above AESDCHAR_MAX_CAPACITY, -ENOMEM
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, size_t max_entries, size_t max_bytes)
+{
+    uint32_t slots = 1;
+
+    if ((0 == max_entries) || (max_entries > AESDCHAR_MAX_CAPACITY))
+    {
+        return -EINVAL;
+    }
+
+    aesd_circular_buffer_init(buffer);
+    while (slots < max_entries)
+    {
+        slots <<= 1;
+    }
+
+    if (slots > AESDCHAR_DEFAULT_SLOTS)
+    {
+        buffer->entry = aesd_alloc_slots(slots, sizeof(struct aesd_buffer_entry));
+        buffer->start_offset = aesd_alloc_slots(slots, sizeof(uint64_t));
+        if ((NULL == buffer->entry) || (NULL == buffer->start_offset))
+        {
+            aesd_circular_buffer_destroy(buffer);
+            return -ENOMEM;
+        }
+        buffer->mask = slots - 1;
+    }
+    buffer->max_entries = max_entries;
+    buffer->max_bytes = max_bytes;
+    return 0;
+}
+
+/**
+* Frees the slots of @param buffer allocated by aesd_circular_buffer_init_capacity, not the memory
+* referenced by its entries. The buffer is left as after aesd_circular_buffer_init
+*/
+void aesd_circular_buffer_destroy(struct aesd_circular_buffer *buffer)
+{
+    if (buffer->entry != buffer->default_entry)
+    {
+        aesd_free_slots(buffer->entry);
+    }
+    if (buffer->start_offset != buffer->default_start_offset)
+    {
+        aesd_free_slots(buffer->start_offset);
+    }
+    aesd_circular_buffer_init(buffer);
 }
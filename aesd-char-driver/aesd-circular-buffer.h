@@ -14,9 +14,23 @@
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <sys/types.h> // ssize_t
+#define __user
 #endif
 
+/**
+ * Default number of entries kept, used by aesd_circular_buffer_init
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+/**
+ * Slots backing the default entries, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED rounded up
+ * to a power of two
+ */
+#define AESDCHAR_DEFAULT_SLOTS 16
+/**
+ * Largest number of entries aesd_circular_buffer_init_capacity accepts
+ */
+#define AESDCHAR_MAX_CAPACITY (1U << 24)
 
 struct aesd_buffer_entry
 {
@@ -33,18 +47,47 @@ struct aesd_buffer_entry
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations,
+     * mask + 1 slots, a power of two so indexes wrap with a mask
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
+    /**
+     * Slots used by aesd_circular_buffer_init, so a default buffer needs no allocation
+     */
+    struct aesd_buffer_entry default_entry[AESDCHAR_DEFAULT_SLOTS];
+    /**
+     * Offset of the first byte of every entry, counted from the first entry ever
+     * added, parallel to entry. Increasing from out_offs, so offsets are found by
+     * binary search
+     */
+    uint64_t *start_offset;
+    uint64_t default_start_offset[AESDCHAR_DEFAULT_SLOTS];
+    /**
+     * start_offset of the oldest entry, which is char_offset 0. Evicting an entry
+     * only advances it
+     */
+    uint64_t base_offset;
+    uint32_t mask;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
+    /**
+     * Number of entries in the buffer, at most max_entries
+     */
+    uint32_t count;
+    uint32_t max_entries;
+    /**
+     * Sum of the sizes of all entries, kept at most max_bytes by evicting the
+     * oldest entries, unless max_bytes is 0
+     */
+    size_t total_size;
+    size_t max_bytes;
     /**
      * set to true when the buffer entry structure is full
      */
@@ -54,18 +97,36 @@ struct aesd_circular_buffer
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern ssize_t aesd_circular_buffer_copy_out(struct aesd_circular_buffer *buffer, size_t char_offset,
+            char __user *buf, size_t count);
+
+extern size_t aesd_circular_buffer_entry_char_offset(struct aesd_circular_buffer *buffer, uint32_t n);
+
+extern bool aesd_circular_buffer_must_evict(struct aesd_circular_buffer *buffer, size_t add_size);
+
+extern bool aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, size_t max_entries, size_t max_bytes);
+
+extern void aesd_circular_buffer_destroy(struct aesd_circular_buffer *buffer);
+
+/**
+ * Index of the entry @param n entries after the oldest one, wrapped with the mask
+ */
+#define AESD_CIRCULAR_BUFFER_INDEX(buffer, n) (((buffer)->out_offs + (n)) & (buffer)->mask)
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +135,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<=(buffer)->mask; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
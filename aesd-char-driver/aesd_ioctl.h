@@ -33,14 +33,126 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One write command in the table copied out by AESDCHAR_IOCGETINDEX
+ */
+struct aesd_index_entry {
+    /**
+     * File offset of the first byte of the command, as used by read and lseek
+     */
+    uint64_t offset;
+    /**
+     * Bytes of the command, including its '\n'
+     */
+    uint64_t size;
+};
+
+/**
+ * Argument of AESDCHAR_IOCGETINDEX
+ */
+struct aesd_index {
+    /**
+     * User pointer to an array of max_entries struct aesd_index_entry, filled with
+     * the first min(count, max_entries) commands, oldest first
+     */
+    uint64_t entries;
+    uint32_t max_entries;
+    /**
+     * Set by the driver to the number of commands stored and the sum of their sizes
+     */
+    uint32_t count;
+    uint64_t total_size;
+};
+
+/**
+ * Argument of AESDCHAR_IOCSEEKTOV, seeks to the first of count positions and
+ * returns the file offset of every one, all resolved against the same history
+ */
+struct aesd_seekto_vec {
+    /**
+     * User pointer to count struct aesd_seekto
+     */
+    uint64_t seektos;
+    /**
+     * User pointer to count uint64_t, set to the file offset of each seekto
+     */
+    uint64_t offsets;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/**
+ * First page of an mmap of the aesd char device, read-only. The stored history
+ * follows at ring_offset as a ring of ring_size bytes: the byte at history offset
+ * pos, counted from the first byte ever written, is at ring[pos & (ring_size - 1)].
+ * Bytes [tail, head) are valid, which is the stored history or its newest ring_size
+ * bytes. Every write command ends in '\n'.
+ *
+ * The driver makes seq odd while it updates the mapping, and moves tail before
+ * it overwrites ring bytes. Readers load seq, read the header and scan the ring,
+ * then load seq again: an odd or changed seq means the snapshot may be torn. A
+ * range [pos, head) that was scanned in place is also still intact if tail <= pos
+ * after the scan.
+ */
+struct aesd_mmap_header {
+    uint32_t seq;
+    /**
+     * Bytes of the ring, a power of two
+     */
+    uint32_t ring_size;
+    /**
+     * Offset of the ring from the start of the mapping, a page size
+     */
+    uint32_t ring_offset;
+    /**
+     * Number of write commands stored and the capacity of the circular buffer
+     */
+    uint32_t count;
+    uint32_t max_entries;
+    /**
+     * Slots of the circular buffer the next command goes to and the oldest is in
+     */
+    uint32_t in_offs;
+    uint32_t out_offs;
+    uint32_t reserved;
+    /**
+     * History offsets one past the newest byte and of the oldest byte in the ring
+     */
+    uint64_t head;
+    uint64_t tail;
+    /**
+     * Bytes stored by the circular buffer, the file size seen by read
+     */
+    uint64_t total_size;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+/**
+ * Passing a nonzero uint32_t makes reads of this file descriptor follow the tail:
+ * at the end of the history they sleep until a write command is added, or fail
+ * with EAGAIN for O_NONBLOCK, and poll only reports it readable once data follows
+ * the file position. Commands evicted before they were read are skipped. 0 turns
+ * it off again, so reads at the end return 0.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+/**
+ * Copies out the offset and size of every stored command in one call, so the
+ * boundaries are known without reading or seeking command by command
+ */
+#define AESDCHAR_IOCGETINDEX _IOWR(AESD_IOC_MAGIC, 3, struct aesd_index)
+/**
+ * AESDCHAR_IOCSEEKTO for several positions at once, fails with EINVAL without
+ * seeking if any of them is past the stored commands, or if count is 0 or more
+ * than the capacity of the device
+ */
+#define AESDCHAR_IOCSEEKTOV _IOWR(AESD_IOC_MAGIC, 4, struct aesd_seekto_vec)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 4
 
 #endif /* AESD_IOCTL_H */
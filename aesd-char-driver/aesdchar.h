@@ -8,29 +8,149 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug in user space
 
 #undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
-     /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
+#ifdef __KERNEL__
+   /* Dynamic debug in kernel space, off until enabled with
+    * echo 'module aesdchar +p' > /sys/kernel/debug/dynamic_debug/control */
+#  define PDEBUG(fmt, args...) pr_debug("aesdchar: " fmt, ## args)
+#elif defined(AESD_DEBUG)
+   /* This one for user space */
+#  define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
 #else
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Page sized piece of a partial write command, still waiting for its '\n'
+ */
+struct aesd_write_chunk
+{
+    struct list_head list;
+    /**
+     * Number of bytes used in data
+     */
+    size_t size;
+    char data[];
+};
+
+#define AESD_WRITE_CHUNK_DATA_SIZE (PAGE_SIZE - sizeof(struct aesd_write_chunk))
+
+/**
+ * Size classes of command storage, 64 to 4096 bytes, each backed by a slab cache,
+ * larger commands are kmalloced
+ */
+#define AESD_STORAGE_CLASSES 4
+/**
+ * Freed storage a device keeps per size class for its next commands
+ */
+#define AESD_STORAGE_POOL_DEPTH 32
+
+struct aesd_storage_pool
+{
+    spinlock_t lock;
+    unsigned int count;
+    void * p_free[AESD_STORAGE_POOL_DEPTH];
+};
+
+enum aesd_storage_stat
+{
+    AESD_STORAGE_POOL_HITS,      // commands stored in reused storage
+    AESD_STORAGE_CACHE_ALLOCS,   // commands stored in new slab cache objects
+    AESD_STORAGE_KMALLOC_ALLOCS, // commands too large for the caches
+    AESD_STORAGE_POOL_RETURNS,   // evicted storage kept for reuse
+    AESD_STORAGE_FREES,          // storage given back to the allocator
+    AESD_STORAGE_STAT_COUNT
+};
+
+enum aesd_stat
+{
+    AESD_STAT_BYTES_READ,
+    AESD_STAT_BYTES_WRITTEN,
+    AESD_STAT_ENTRIES_COMMITTED,
+    AESD_STAT_ENTRIES_EVICTED,
+    AESD_STAT_PARTIAL_WRITES,    // writes leaving a command without its '\n' staged
+    AESD_STAT_LOCK_CONTENDED,    // device lock acquisitions that had to wait
+    AESD_STAT_LOCK_WAIT_NS,      // time spent waiting in them
+    AESD_STAT_IOCTLS,
+    AESD_STAT_COUNT
+};
+
+/**
+ * Counters of a device, one copy per CPU so the hot paths never share a cache line
+ * for them, summed over the CPUs when read
+ */
+struct aesd_stats
+{
+    u64 count[AESD_STAT_COUNT];
+    u64 storage[AESD_STORAGE_STAT_COUNT];
+};
+
 struct aesd_dev
 {
-    void * p_write_buffer;
-    size_t write_buffer_size;
-    struct mutex lock;
+    /**
+     * Woken whenever a write command is added, for readers following the tail
+     */
+    wait_queue_head_t wait_queue;
+    /**
+     * History offset one past the newest byte, base_offset + total_size of the
+     * circular buffer, readable without the lock
+     */
+    atomic64_t head;
+    /**
+     * held for reading by aesd_read, aesd_llseek and aesd_ioctl, so readers run in
+     * parallel, and for writing while aesd_write adds a command
+     */
+    struct rw_semaphore lock;
     struct aesd_circular_buffer circular_buffer; 
+    /**
+     * Header page and history ring exposed by mmap, in one vmalloc_user area,
+     * NULL if mmap is disabled
+     */
+    struct aesd_mmap_header * p_mmap_header;
+    char * p_mmap_ring;
+    /**
+     * Storage of evicted commands, reused before allocating
+     */
+    struct aesd_storage_pool storage_pool[AESD_STORAGE_CLASSES];
+    struct aesd_stats __percpu * p_stats;
+    struct dentry * p_debugfs_dir;
     struct cdev cdev;     /* Char device structure      */
 };
 
+/**
+ * State of one open file of the device, in its private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev * p_dev;
+    /**
+     * Serializes reads and AESDCHAR_IOCFOLLOW through this file, taken before the
+     * device lock, guards b_follow, follow_pos and follow_f_pos
+     */
+    struct mutex follow_lock;
+    /**
+     * Set by AESDCHAR_IOCFOLLOW, reads then start at follow_pos, an offset into the
+     * whole history written so far, which stays valid while entries are evicted
+     */
+    bool b_follow;
+    uint64_t follow_pos;
+    /**
+     * f_pos as left by the last read, a different f_pos means the file was seeked
+     */
+    loff_t follow_f_pos;
+    /**
+     * Chunks of the partial write command of this file, oldest first, only copied
+     * into one buffer once the command is complete
+     */
+    struct list_head write_chunks;
+    size_t write_buffer_size;
+    /**
+     * Serializes writes through this file, they only take the device lock to add
+     * a complete command
+     */
+    struct mutex write_lock;
+};
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
@@ -12,15 +12,31 @@
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/sched/signal.h>
 #include <linux/fs.h> // file_operations
 #include "aesd-circular-buffer.h"
-#include "aesdchar.h"
 #include "aesd_ioctl.h"
+#include "aesdchar.h"
 
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
@@ -28,7 +44,47 @@ int aesd_minor =   0;
 MODULE_AUTHOR("krish0706"); 
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+// history depth in entries, rounded up to a power of two for the slots, and
+// byte budget, the oldest entries are evicted to stay within both
+static unsigned int capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(capacity, uint, S_IRUGO);
+MODULE_PARM_DESC(capacity, "Number of write commands kept (default 10)");
+static unsigned long byte_budget = 0;
+module_param(byte_budget, ulong, S_IRUGO);
+MODULE_PARM_DESC(byte_budget, "Bytes of write commands kept, 0 for no limit (default 0)");
+// bytes of history exposed through mmap, rounded up to a power of two, allocated by the
+// first mmap of a device
+static unsigned long mmap_size = 1UL << 20;
+module_param(mmap_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(mmap_size, "Bytes of history mappable read-only, allocated on first mmap, 0 to disable mmap (default 1 MiB)");
+// minors, /dev/aesdchar0 .. /dev/aesdchar<nr_devices - 1>, each with its own history and lock
+#define AESD_MAX_DEVICES 256
+static unsigned int nr_devices = 1;
+module_param(nr_devices, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices, each with its own history and lock (default 1)");
+
+// one separately allocated device per minor
+struct aesd_dev ** aesd_devices;
+
+// slab caches of the command storage classes, shared by all devices
+static const size_t aesd_storage_class_size[AESD_STORAGE_CLASSES] = {64, 256, 1024, 4096};
+static const char * const aesd_storage_class_name[AESD_STORAGE_CLASSES] = {
+    "aesdchar_64", "aesdchar_256", "aesdchar_1024", "aesdchar_4096"
+};
+static struct kmem_cache * aesd_storage_cache[AESD_STORAGE_CLASSES];
+
+// debugfs directory holding one directory of statistics per device
+static struct dentry * aesd_debugfs_root;
+
+// evicted commands freed after the device lock is released, more are freed in place
+#define AESD_DEFERRED_FREES 8
+
+// index entries and seektos copied between user and kernel at a time, on the stack
+#define AESD_IOCTL_BATCH 32
+
+// counters of the calling CPU, see struct aesd_stats
+#define aesd_stat_add(p_dev, stat, n) this_cpu_add((p_dev)->p_stats->count[stat], n)
+#define aesd_storage_stat_inc(p_dev, stat) this_cpu_inc((p_dev)->p_stats->storage[stat])
 
 // function prototypes
 int aesd_open (struct inode *inode, struct file *filp);
@@ -37,143 +93,554 @@ ssize_t aesd_read (struct file *filp, char __user *buf, size_t count, loff_t *f_
 ssize_t aesd_write (struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
 loff_t aesd_llseek (struct file * filp, loff_t off, int whence);
 long aesd_ioctl (struct file * filep, unsigned int cmd, unsigned long arg);
+int aesd_mmap (struct file * filp, struct vm_area_struct * vma);
+__poll_t aesd_poll (struct file * filp, poll_table * wait);
 int aesd_init_module (void);
 void aesd_cleanup_module (void);
 
+/*
+ * Size class of a command of size bytes, AESD_STORAGE_CLASSES if it is too large for the caches
+ */
+static unsigned int aesd_storage_class(size_t size)
+{
+    unsigned int class = 0;
+
+    while ((class < AESD_STORAGE_CLASSES) && (size > aesd_storage_class_size[class]))
+    {
+        class++;
+    }
+    return class;
+}
+
+/*
+ * Storage for a command of size bytes, reusing evicted storage of its size class first
+ */
+static char * aesd_storage_alloc(struct aesd_dev * p_dev, size_t size)
+{
+    unsigned int class = aesd_storage_class(size);
+    struct aesd_storage_pool * p_pool;
+    void * p_storage = NULL;
+
+    if (class == AESD_STORAGE_CLASSES)
+    {
+        p_storage = kmalloc(size, GFP_KERNEL);
+        if (p_storage != NULL)
+        {
+            aesd_storage_stat_inc(p_dev, AESD_STORAGE_KMALLOC_ALLOCS);
+        }
+        return p_storage;
+    }
+
+    p_pool = &p_dev->storage_pool[class];
+    spin_lock(&p_pool->lock);
+    if (p_pool->count > 0)
+    {
+        p_storage = p_pool->p_free[--p_pool->count];
+    }
+    spin_unlock(&p_pool->lock);
+
+    if (p_storage != NULL)
+    {
+        aesd_storage_stat_inc(p_dev, AESD_STORAGE_POOL_HITS);
+        return p_storage;
+    }
+    p_storage = kmem_cache_alloc(aesd_storage_cache[class], GFP_KERNEL);
+    if (p_storage != NULL)
+    {
+        aesd_storage_stat_inc(p_dev, AESD_STORAGE_CACHE_ALLOCS);
+    }
+    return p_storage;
+}
+
+/*
+ * Gives back the storage of a command of size bytes, kept for reuse while the pool of its
+ * size class has room
+ */
+static void aesd_storage_free(struct aesd_dev * p_dev, const char * p_storage, size_t size)
+{
+    unsigned int class = aesd_storage_class(size);
+    struct aesd_storage_pool * p_pool;
+    bool b_kept = false;
+
+    if (p_storage == NULL)
+    {
+        return;
+    }
+    if (class == AESD_STORAGE_CLASSES)
+    {
+        kfree(p_storage);
+        aesd_storage_stat_inc(p_dev, AESD_STORAGE_FREES);
+        return;
+    }
+
+    p_pool = &p_dev->storage_pool[class];
+    spin_lock(&p_pool->lock);
+    if (p_pool->count < AESD_STORAGE_POOL_DEPTH)
+    {
+        p_pool->p_free[p_pool->count++] = (void *)p_storage;
+        b_kept = true;
+    }
+    spin_unlock(&p_pool->lock);
+
+    if (b_kept)
+    {
+        aesd_storage_stat_inc(p_dev, AESD_STORAGE_POOL_RETURNS);
+    }
+    else
+    {
+        kmem_cache_free(aesd_storage_cache[class], (void *)p_storage);
+        aesd_storage_stat_inc(p_dev, AESD_STORAGE_FREES);
+    }
+}
+
+/*
+ * Drops the newest bytes of the partial write command of p_file, keeping the first new_size
+ */
+static void aesd_truncate_write_chunks(struct aesd_file * p_file, size_t new_size)
+{
+    struct aesd_write_chunk * p_chunk, * p_tmp;
+    size_t size = p_file->write_buffer_size;
+
+    list_for_each_entry_safe_reverse(p_chunk, p_tmp, &p_file->write_chunks, list)
+    {
+        if (size - p_chunk->size >= new_size)
+        {
+            // the whole chunk is past new_size
+            size -= p_chunk->size;
+            list_del(&p_chunk->list);
+            kfree(p_chunk);
+        }
+        else
+        {
+            p_chunk->size -= size - new_size;
+            break;
+        }
+    }
+    p_file->write_buffer_size = new_size;
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
     PDEBUG("open\n");
-    struct aesd_dev * p_dev;
+    struct aesd_file * p_file;
 
-    // store p_dev in private_data for use in other methods
-    p_dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = p_dev;
+    // store the state of this file and p_dev in private_data for use in other methods
+    p_file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (p_file == NULL)
+    {
+        return -ENOMEM;
+    }
+    p_file->p_dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    INIT_LIST_HEAD(&p_file->write_chunks);
+    mutex_init(&p_file->write_lock);
+    mutex_init(&p_file->follow_lock);
+    filp->private_data = p_file;
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
     PDEBUG("release\n");
+    // a command still missing its '\n' is dropped with the file
+    aesd_truncate_write_chunks(filp->private_data, 0);
+    kfree(filp->private_data);
     return 0;
 }
 
+/*
+ * Takes the device lock shared, timing the wait only when it is contended
+ * @return 0, or -ERESTARTSYS if killed while waiting
+ */
+static int aesd_down_read(struct aesd_dev * p_dev)
+{
+    u64 start;
+
+    if (down_read_trylock(&p_dev->lock))
+    {
+        return 0;
+    }
+    start = ktime_get_ns();
+    if (down_read_killable(&p_dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+    aesd_stat_add(p_dev, AESD_STAT_LOCK_CONTENDED, 1);
+    aesd_stat_add(p_dev, AESD_STAT_LOCK_WAIT_NS, ktime_get_ns() - start);
+    return 0;
+}
+
+/*
+ * Takes the device lock exclusively, timing the wait only when it is contended
+ * @return 0, or -ERESTARTSYS if killed while waiting
+ */
+static int aesd_down_write(struct aesd_dev * p_dev)
+{
+    u64 start;
+
+    if (down_write_trylock(&p_dev->lock))
+    {
+        return 0;
+    }
+    start = ktime_get_ns();
+    if (down_write_killable(&p_dev->lock))
+    {
+        return -ERESTARTSYS;
+    }
+    aesd_stat_add(p_dev, AESD_STAT_LOCK_CONTENDED, 1);
+    aesd_stat_add(p_dev, AESD_STAT_LOCK_WAIT_NS, ktime_get_ns() - start);
+    return 0;
+}
+
+/*
+ * Moves the follow position of p_file past evicted commands and sets f_pos to it.
+ * Must hold the lock of the device.
+ */
+static void aesd_follow_sync(struct aesd_file * p_file, loff_t * f_pos)
+{
+    uint64_t base_offset = p_file->p_dev->circular_buffer.base_offset;
+
+    if (p_file->follow_pos < base_offset)
+    {
+        p_file->follow_pos = base_offset;
+    }
+    *f_pos = p_file->follow_pos - base_offset;
+}
+
 ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
                 loff_t *f_pos)
 {
-    struct aesd_dev * p_dev = filp->private_data;
-    struct aesd_buffer_entry * p_entry = NULL;
+    struct aesd_file * p_file = filp->private_data;
+    struct aesd_dev * p_dev = p_file->p_dev;
     ssize_t retval = 0;
-    size_t offset = 0;
 
     PDEBUG("read %zu bytes with offset %lld\n",count,*f_pos);
 
-     // acquire mutex
-    if (mutex_lock_interruptible(&p_dev->lock))
+    // serialize reads through this file, they share the follow state
+    if (mutex_lock_interruptible(&p_file->follow_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    // acquire lock shared with other readers
+    if (aesd_down_read(p_dev))
     {
+        mutex_unlock(&p_file->follow_lock);
         return -ERESTARTSYS;
     }
 
-    // find entry corresponding to given offset
-    if ((p_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&p_dev->circular_buffer, *f_pos, &offset)) == NULL)
+    if (p_file->b_follow)
+    {
+        // a seek since the last read moves the follow position as well
+        if (*f_pos != p_file->follow_f_pos)
+        {
+            p_file->follow_pos = p_dev->circular_buffer.base_offset + *f_pos;
+        }
+        aesd_follow_sync(p_file, f_pos);
+
+        // at the tail, wait for the next command without holding either lock, so
+        // AESDCHAR_IOCFOLLOW and other readers of this file are not blocked meanwhile
+        while ((count > 0) && (*f_pos >= p_dev->circular_buffer.total_size))
+        {
+            uint64_t follow_pos = p_file->follow_pos;
+
+            up_read(&p_dev->lock);
+            mutex_unlock(&p_file->follow_lock);
+            if (filp->f_flags & O_NONBLOCK)
+            {
+                return -EAGAIN;
+            }
+            if (wait_event_interruptible(p_dev->wait_queue, atomic64_read(&p_dev->head) > follow_pos))
+            {
+                return -ERESTARTSYS;
+            }
+            if (mutex_lock_interruptible(&p_file->follow_lock))
+            {
+                return -ERESTARTSYS;
+            }
+            if (aesd_down_read(p_dev))
+            {
+                mutex_unlock(&p_file->follow_lock);
+                return -ERESTARTSYS;
+            }
+            if (!p_file->b_follow)
+            {
+                // follow mode was turned off while waiting, read like a file
+                break;
+            }
+            aesd_follow_sync(p_file, f_pos);
+        }
+    }
+
+    // copy as many commands as fit in count, starting at the entry holding f_pos
+    retval = aesd_circular_buffer_copy_out(&p_dev->circular_buffer, *f_pos, buf, count);
+    if (retval > 0)
     {
-        goto end;
+        *f_pos += retval;
+        aesd_stat_add(p_dev, AESD_STAT_BYTES_READ, retval);
+    }
+    if (p_file->b_follow)
+    {
+        p_file->follow_pos = p_dev->circular_buffer.base_offset + *f_pos;
+        p_file->follow_f_pos = *f_pos;
     }
 
-    // check how many bytes are available in the buffer after the offset
-    size_t bytes_available = p_entry->size - offset;
+    // release locks
+    up_read(&p_dev->lock);
+    mutex_unlock(&p_file->follow_lock);
+    return retval;
+}
 
-    // if buffer has more bytes than requested, limit number of bytes to count, else
-    // limit it the number of bytes available
-    size_t bytes_to_copy = (bytes_available > count) ? count : bytes_available;
+/*
+ * Copies size bytes at p_data to history offset offset of the mmap ring of p_dev,
+ * wrapping around its end
+ */
+static void aesd_mmap_copy(struct aesd_dev * p_dev, uint64_t offset, const char * p_data, size_t size)
+{
+    uint32_t ring_size = p_dev->p_mmap_header->ring_size;
+    uint32_t start = offset & (ring_size - 1);
+    size_t first = min_t(size_t, size, ring_size - start);
+
+    memcpy(p_dev->p_mmap_ring + start, p_data, first);
+    memcpy(p_dev->p_mmap_ring, p_data + first, size - first);
+}
 
-    if (copy_to_user(buf, &p_entry->buffptr[offset], bytes_to_copy))
+/*
+ * Copies the newest command p_record of size bytes into the mmap ring of p_dev, and
+ * updates the header to the circular buffer. Must run after the command was added.
+ * Does nothing until the device was mapped once.
+ */
+static void aesd_mmap_publish(struct aesd_dev * p_dev, const char * p_record, size_t size)
+{
+    struct aesd_mmap_header * p_header = p_dev->p_mmap_header;
+    struct aesd_circular_buffer * p_buffer = &p_dev->circular_buffer;
+    uint64_t head = p_buffer->base_offset + p_buffer->total_size;
+    uint64_t tail = p_buffer->base_offset;
+    uint32_t ring_size;
+
+    if (p_header == NULL)
     {
-        goto end;
+        return;
     }
 
-    *f_pos += bytes_to_copy;
-    retval = bytes_to_copy;
+    ring_size = p_header->ring_size;
+    if (head - tail > ring_size)
+    {
+        tail = head - ring_size;
+    }
+    if (size > ring_size)
+    {
+        // only the newest ring_size bytes fit
+        p_record += size - ring_size;
+        size = ring_size;
+    }
 
-    end: 
-        // release mutex
-        mutex_unlock(&p_dev->lock);
-        return retval;
+    WRITE_ONCE(p_header->seq, p_header->seq + 1);
+    smp_wmb();
+    // readers see the new tail before the bytes it frees are overwritten
+    WRITE_ONCE(p_header->tail, tail);
+    smp_wmb();
+
+    aesd_mmap_copy(p_dev, head - size, p_record, size);
+    smp_wmb();
+
+    WRITE_ONCE(p_header->head, head);
+    WRITE_ONCE(p_header->total_size, p_buffer->total_size);
+    WRITE_ONCE(p_header->count, p_buffer->count);
+    WRITE_ONCE(p_header->in_offs, p_buffer->in_offs);
+    WRITE_ONCE(p_header->out_offs, p_buffer->out_offs);
+    smp_wmb();
+    WRITE_ONCE(p_header->seq, p_header->seq + 1);
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+/*
+ * Copies the partial write command of p_file, up to tail bytes before its end, into a single
+ * buffer and adds it to the circular buffer of the device, the only step taking the device
+ * lock. The tail bytes stay in the newest chunk and start the next command.
+ */
+static int aesd_commit_write_chunks(struct aesd_file * p_file, size_t tail)
 {
-    PDEBUG("write %zu bytes with offset %lld\n",count,*f_pos);
-    struct aesd_dev * p_dev = filp->private_data;
-    ssize_t retval = -ENOMEM;
+    struct aesd_dev * p_dev = p_file->p_dev;
+    struct aesd_write_chunk * p_chunk, * p_tmp;
+    struct aesd_write_chunk * p_newest = list_last_entry(&p_file->write_chunks, struct aesd_write_chunk, list);
+    struct aesd_buffer_entry entry = {.size=p_file->write_buffer_size - tail};
+    struct aesd_buffer_entry evicted[AESD_DEFERRED_FREES];
+    unsigned int evicted_count = 0;
+    unsigned int evicted_total = 0;
+    char * p_record;
+    size_t offset = 0;
 
-     // acquire mutex
-    if (mutex_lock_interruptible(&p_dev->lock))
+    p_record = aesd_storage_alloc(p_dev, entry.size);
+    if (p_record == NULL)
     {
-        return -ERESTARTSYS;
+        return -ENOMEM;
     }
 
-    // realloc to create enough space for the incoming data, if write_buffer_size is 0,
-    // this will act as malloc
-    void * p_tmp = krealloc(p_dev->p_write_buffer, count + p_dev->write_buffer_size, GFP_KERNEL);
-    if (p_tmp == NULL)
+    // linearize, the chunks belong to this file and need no device lock
+    list_for_each_entry(p_chunk, &p_file->write_chunks, list)
     {
-        kfree(p_dev->p_write_buffer);
-        retval = -ENOMEM;
-        goto end;
+        size_t size = (p_chunk == p_newest) ? p_chunk->size - tail : p_chunk->size;
+        memcpy(p_record + offset, p_chunk->data, size);
+        offset += size;
     }
-    else
+    entry.buffptr = p_record;
+
+    // acquire lock exclusively, the circular buffer changes
+    if (aesd_down_write(p_dev))
     {
-        p_dev->p_write_buffer = p_tmp;
+        aesd_storage_free(p_dev, p_record, entry.size);
+        return -ERESTARTSYS;
     }
 
-    // copy data to buffer at correct index to not overwrite previous data
-    if (copy_from_user(p_dev->p_write_buffer + p_dev->write_buffer_size, buf, count))
+    while (aesd_circular_buffer_must_evict(&p_dev->circular_buffer, entry.size))
     {
-        retval = -EFAULT;
-        goto end;
+        // if buffer is full or over its byte budget, remove oldest data before adding,
+        // it is freed once the lock is released
+        PDEBUG("buffer is full, deleting oldest entry\n");
+        aesd_circular_buffer_remove_oldest(&p_dev->circular_buffer, &evicted[evicted_count]);
+        evicted_total++;
+        if (evicted_count < AESD_DEFERRED_FREES - 1)
+        {
+            evicted_count++;
+        }
+        else
+        {
+            aesd_storage_free(p_dev, evicted[evicted_count].buffptr, evicted[evicted_count].size);
+        }
     }
-    else
+
+    PDEBUG("adding entry to buffer\n");
+    aesd_circular_buffer_add_entry(&p_dev->circular_buffer, &entry);
+    aesd_mmap_publish(p_dev, p_record, entry.size);
+    atomic64_set(&p_dev->head, p_dev->circular_buffer.base_offset + p_dev->circular_buffer.total_size);
+
+    // release lock
+    up_write(&p_dev->lock);
+    aesd_stat_add(p_dev, AESD_STAT_ENTRIES_COMMITTED, 1);
+    aesd_stat_add(p_dev, AESD_STAT_ENTRIES_EVICTED, evicted_total);
+
+    // readers can no longer reach the evicted commands
+    while (evicted_count > 0)
+    {
+        evicted_count--;
+        aesd_storage_free(p_dev, evicted[evicted_count].buffptr, evicted[evicted_count].size);
+    }
+
+    // free every chunk but the newest, which is reused for the tail
+    list_for_each_entry_safe(p_chunk, p_tmp, &p_file->write_chunks, list)
     {
-        // all bytes copied successfully from user space
-        retval = count;
+        if (p_chunk == p_newest)
+        {
+            memmove(p_chunk->data, p_chunk->data + p_chunk->size - tail, tail);
+            p_chunk->size = tail;
+        }
+        else
+        {
+            list_del(&p_chunk->list);
+            kfree(p_chunk);
+        }
     }
+    p_file->write_buffer_size = tail;
+    return 0;
+}
 
-    // update write_buffer_size
-    p_dev->write_buffer_size += count;
+ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
+                loff_t *f_pos)
+{
+    PDEBUG("write %zu bytes with offset %lld\n",count,*f_pos);
+    struct aesd_file * p_file = filp->private_data;
+    struct aesd_dev * p_dev = p_file->p_dev;
+    ssize_t retval = 0;
+    // bytes of buf staged in chunks, and those of them in committed commands
+    size_t copied = 0;
+    size_t committed = 0;
 
-    // check if the write_buffer contains a \n
-    int b_contains_newline = (memchr(p_dev->p_write_buffer, '\n', p_dev->write_buffer_size) != NULL) ? 1 : 0;
+    // acquire the staging lock of this file, the device lock is only taken to commit
+    if (mutex_lock_interruptible(&p_file->write_lock))
+    {
+        return -ERESTARTSYS;
+    }
 
-    if (b_contains_newline)
+    while (copied < count)
     {
-        struct aesd_buffer_entry entry = {.buffptr=p_dev->p_write_buffer, .size=p_dev->write_buffer_size};
-        if (p_dev->circular_buffer.full)
+        struct aesd_write_chunk * p_chunk = NULL;
+        if (!list_empty(&p_file->write_chunks))
         {
-            // if buffer is full, free oldest data before adding
-            PDEBUG("buffer is full, deleing oldest entry");
-            int out_offs = p_dev->circular_buffer.out_offs;
-            kfree(p_dev->circular_buffer.entry[out_offs].buffptr);
+            p_chunk = list_last_entry(&p_file->write_chunks, struct aesd_write_chunk, list);
         }
 
-        PDEBUG("adding entry to buffer");
-        aesd_circular_buffer_add_entry(&p_dev->circular_buffer, &entry);
+        // append a new chunk once the newest one is full
+        if ((p_chunk == NULL) || (p_chunk->size == AESD_WRITE_CHUNK_DATA_SIZE))
+        {
+            p_chunk = kmalloc(PAGE_SIZE, GFP_KERNEL);
+            if (p_chunk == NULL)
+            {
+                retval = -ENOMEM;
+                goto end;
+            }
+            p_chunk->size = 0;
+            list_add_tail(&p_chunk->list, &p_file->write_chunks);
+        }
 
-        // reset write buffer variables 
-        p_dev->write_buffer_size = 0;
-        p_dev->p_write_buffer = NULL;
+        size_t bytes_to_copy = min_t(size_t, AESD_WRITE_CHUNK_DATA_SIZE - p_chunk->size, count - copied);
+        char * p_new = p_chunk->data + p_chunk->size;
+        if (copy_from_user(p_new, buf + copied, bytes_to_copy))
+        {
+            retval = -EFAULT;
+            goto end;
+        }
+        p_chunk->size += bytes_to_copy;
+        p_file->write_buffer_size += bytes_to_copy;
+        copied += bytes_to_copy;
+
+        // only the new bytes can hold a '\n', every one completes a command
+        char * p_newline;
+        while ((p_newline = memchr(p_new, '\n', p_chunk->data + p_chunk->size - p_new)) != NULL)
+        {
+            size_t tail = p_chunk->data + p_chunk->size - (p_newline + 1);
+            retval = aesd_commit_write_chunks(p_file, tail);
+            if (retval)
+            {
+                goto end;
+            }
+            committed = copied - tail;
+            // the tail moved to the start of the chunk
+            p_new = p_chunk->data;
+        }
     }
-    
+    retval = count;
+
     end: 
-        // release mutex
-        mutex_unlock(&p_dev->lock);
+        if (retval < 0)
+        {
+            // drop the bytes of buf after the last committed command, and report
+            // the committed ones if there are any
+            aesd_truncate_write_chunks(p_file, p_file->write_buffer_size - (copied - committed));
+            if (committed > 0)
+            {
+                retval = committed;
+            }
+        }
+        if (retval > 0)
+        {
+            aesd_stat_add(p_dev, AESD_STAT_BYTES_WRITTEN, retval);
+            if (p_file->write_buffer_size > 0)
+            {
+                aesd_stat_add(p_dev, AESD_STAT_PARTIAL_WRITES, 1);
+            }
+        }
+        // release lock
+        mutex_unlock(&p_file->write_lock);
+        // wake readers following the tail
+        if (committed > 0)
+        {
+            wake_up_interruptible(&p_dev->wait_queue);
+        }
         return retval;
 }
 
 loff_t aesd_llseek(struct file * filp, loff_t off, int whence)
 {
     PDEBUG("llseek %d offset %lld\n", whence, off);
-    struct aesd_dev * p_dev = filp->private_data;
+    struct aesd_dev * p_dev = ((struct aesd_file *)filp->private_data)->p_dev;
     loff_t newpos;
     
     switch (whence)
@@ -192,27 +659,20 @@ loff_t aesd_llseek(struct file * filp, loff_t off, int whence)
             // we need to make sure that our access to the circular buffer is atomic, so that the size does
             // not change when we are measuring it
 
-            // acquire mutex
-            if (mutex_lock_interruptible(&p_dev->lock))
+            // acquire lock shared with readers
+            if (aesd_down_read(p_dev))
             {
                 return -ERESTARTSYS;
             }
             
-            int file_size = 0;
-            for (int idx = p_dev->circular_buffer.out_offs; 
-                 idx != p_dev->circular_buffer.in_offs; 
-                 idx = (idx+1)%AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
-            {
-                // each command has a size, including the '\n', add them all up
-                // to find the size of the entire file 
-                file_size += p_dev->circular_buffer.entry[idx].size;
-            }
+            // the buffer keeps the sum of the sizes of all commands, including the '\n'
+            loff_t file_size = p_dev->circular_buffer.total_size;
 
-            // free mutex
-            mutex_unlock(&p_dev->lock);
+            // free lock
+            up_read(&p_dev->lock);
 
-            // end of file be at position file_size - 1
-            newpos = file_size - 1 + off;
+            // end of file is one past the last byte, like for a regular file
+            newpos = file_size + off;
         break;
 
         default:
@@ -229,13 +689,163 @@ loff_t aesd_llseek(struct file * filp, loff_t off, int whence)
     return newpos;
 }
 
+/*
+ * File offset of seekto in the history of p_dev, -EINVAL if it is past the stored
+ * commands. Must be called with the device lock held
+ */
+static loff_t aesd_seekto_offset(struct aesd_dev * p_dev, const struct aesd_seekto * p_seekto)
+{
+    uint32_t cmd_idx;
+
+    if (p_seekto->write_cmd >= p_dev->circular_buffer.count)
+    {
+        // not enough cmds in buffer
+        PDEBUG("Not enough cmds in buffer!\n");
+        return -EINVAL;
+    }
+
+    cmd_idx = AESD_CIRCULAR_BUFFER_INDEX(&p_dev->circular_buffer, p_seekto->write_cmd);
+    if (p_seekto->write_cmd_offset >= p_dev->circular_buffer.entry[cmd_idx].size)
+    {
+        // not enough characters in entry
+        PDEBUG("Not enough characters in entry!\n");
+        return -EINVAL;
+    }
+
+    // the buffer keeps the offset each command starts at
+    return aesd_circular_buffer_entry_char_offset(&p_dev->circular_buffer, p_seekto->write_cmd) +
+           p_seekto->write_cmd_offset;
+}
+
+/*
+ * AESDCHAR_IOCGETINDEX, copies the offset and size of the stored commands to the user
+ * array of p_index in batches, all under one hold of the read lock
+ */
+static long aesd_get_index(struct aesd_dev * p_dev, struct aesd_index * p_index)
+{
+    struct aesd_index_entry batch[AESD_IOCTL_BATCH];
+    struct aesd_index_entry __user * p_entries = u64_to_user_ptr(p_index->entries);
+    uint32_t copied = 0;
+    long retval = 0;
+
+    if (aesd_down_read(p_dev))
+    {
+        return -ERESTARTSYS;
+    }
+
+    p_index->count = p_dev->circular_buffer.count;
+    p_index->total_size = p_dev->circular_buffer.total_size;
+    while ((copied < p_index->count) && (copied < p_index->max_entries))
+    {
+        uint32_t batch_size = min3(p_index->count - copied, p_index->max_entries - copied, (uint32_t)AESD_IOCTL_BATCH);
+        uint32_t idx;
+
+        if (fatal_signal_pending(current))
+        {
+            retval = -EINTR;
+            break;
+        }
+
+        for (idx = 0; idx < batch_size; idx++)
+        {
+            uint32_t cmd_idx = AESD_CIRCULAR_BUFFER_INDEX(&p_dev->circular_buffer, copied + idx);
+            batch[idx].offset = aesd_circular_buffer_entry_char_offset(&p_dev->circular_buffer, copied + idx);
+            batch[idx].size = p_dev->circular_buffer.entry[cmd_idx].size;
+        }
+        if (copy_to_user(p_entries + copied, batch, batch_size * sizeof(batch[0])))
+        {
+            retval = -EFAULT;
+            break;
+        }
+        copied += batch_size;
+    }
+
+    up_read(&p_dev->lock);
+    return retval;
+}
+
+/*
+ * AESDCHAR_IOCSEEKTOV, resolves every seekto of p_vec under one hold of the read lock
+ * and seeks filp to the first one once all of them are valid
+ */
+static long aesd_seekto_vec(struct file * filp, struct aesd_dev * p_dev, const struct aesd_seekto_vec * p_vec)
+{
+    struct aesd_seekto batch[AESD_IOCTL_BATCH];
+    uint64_t offsets[AESD_IOCTL_BATCH];
+    const struct aesd_seekto __user * p_seektos = u64_to_user_ptr(p_vec->seektos);
+    uint64_t __user * p_offsets = u64_to_user_ptr(p_vec->offsets);
+    loff_t first = 0;
+    uint32_t done = 0;
+    long retval = 0;
+
+    // more seektos than the device ever holds would only stall writers, max_entries
+    // does not change after init and needs no lock
+    if ((0 == p_vec->count) || (p_vec->count > p_dev->circular_buffer.max_entries))
+    {
+        return -EINVAL;
+    }
+
+    if (aesd_down_read(p_dev))
+    {
+        return -ERESTARTSYS;
+    }
+
+    while ((0 == retval) && (done < p_vec->count))
+    {
+        uint32_t batch_size = min_t(uint32_t, p_vec->count - done, AESD_IOCTL_BATCH);
+        uint32_t idx;
+
+        if (fatal_signal_pending(current))
+        {
+            retval = -EINTR;
+            break;
+        }
+        if (copy_from_user(batch, p_seektos + done, batch_size * sizeof(batch[0])))
+        {
+            retval = -EFAULT;
+            break;
+        }
+        for (idx = 0; idx < batch_size; idx++)
+        {
+            loff_t offset = aesd_seekto_offset(p_dev, &batch[idx]);
+            if (offset < 0)
+            {
+                retval = offset;
+                break;
+            }
+            offsets[idx] = offset;
+        }
+        if ((0 == retval) && copy_to_user(p_offsets + done, offsets, batch_size * sizeof(offsets[0])))
+        {
+            retval = -EFAULT;
+        }
+        if ((0 == retval) && (0 == done))
+        {
+            first = offsets[0];
+        }
+        done += batch_size;
+    }
+
+    if (0 == retval)
+    {
+        filp->f_pos = first;
+    }
+    up_read(&p_dev->lock);
+    return retval;
+}
+
 long aesd_ioctl(struct file * filp, unsigned int cmd, unsigned long arg)
 {
     PDEBUG("ioctl\n");
-    int retval = 0;
-    struct aesd_dev * p_dev = filp->private_data;
+    long retval = 0;
+    struct aesd_file * p_file = filp->private_data;
+    struct aesd_dev * p_dev = p_file->p_dev;
     struct aesd_seekto seekto;
+    struct aesd_index index;
+    struct aesd_seekto_vec seekto_vec;
+    uint32_t follow;
 
+    aesd_stat_add(p_dev, AESD_STAT_IOCTLS, 1);
     switch (cmd)
     {
         case AESDCHAR_IOCSEEKTO:
@@ -246,47 +856,83 @@ long aesd_ioctl(struct file * filp, unsigned int cmd, unsigned long arg)
             }
             else
             {
-                // acquire mutex
-                if (mutex_lock_interruptible(&p_dev->lock))
+                // acquire lock shared with readers
+                if (aesd_down_read(p_dev))
                 {
                     return -ERESTARTSYS;
                 }
 
-                if (seekto.write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+                loff_t write_cmd_offset = aesd_seekto_offset(p_dev, &seekto);
+                if (write_cmd_offset < 0)
                 {
-                    // not enough cmds in buffer
-                    PDEBUG("Not enough cmds in buffer!\n");
-                    retval = -EINVAL;
+                    retval = write_cmd_offset;
                 }
                 else
                 {
-                    int cmd_idx = (seekto.write_cmd + p_dev->circular_buffer.out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-                    int cmd_size = p_dev->circular_buffer.entry[cmd_idx].size;
-                    if (seekto.write_cmd_offset < cmd_size)
-                    {
-                        int write_cmd_offset = 0;
-                        for (int idx = p_dev->circular_buffer.out_offs; 
-                            idx != cmd_idx; 
-                            idx = (idx+1)%AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
-                        {
-                            // each command has a size, including the '\n', add them all up
-                            // to find the size of the entire file 
-                            write_cmd_offset += p_dev->circular_buffer.entry[idx].size;
-                        }
-
-                        write_cmd_offset += seekto.write_cmd_offset;
-                        filp->f_pos += write_cmd_offset;
-                    }
-                    else
-                    {
-                        // not enough characters in entry
-                        PDEBUG("Not enough characters in entry!");
-                        retval = -EINVAL;
-                    }
+                    filp->f_pos = write_cmd_offset;
+                }
+
+                // free lock
+                up_read(&p_dev->lock);
+            }
+        break;
+
+        case AESDCHAR_IOCFOLLOW:
+            PDEBUG("AESDCHAR_IOCFOLLOW\n");
+            if (copy_from_user(&follow, (const void __user *)arg, sizeof(follow)))
+            {
+                retval = -EFAULT;
+            }
+            else
+            {
+                // acquire the follow state of this file, then lock shared with readers
+                if (mutex_lock_interruptible(&p_file->follow_lock))
+                {
+                    return -ERESTARTSYS;
                 }
-                
-                // free mutex
-                mutex_unlock(&p_dev->lock);
+                if (aesd_down_read(p_dev))
+                {
+                    mutex_unlock(&p_file->follow_lock);
+                    return -ERESTARTSYS;
+                }
+
+                // follow from the current position
+                p_file->b_follow = (follow != 0);
+                p_file->follow_pos = p_dev->circular_buffer.base_offset + filp->f_pos;
+                p_file->follow_f_pos = filp->f_pos;
+
+                // free locks
+                up_read(&p_dev->lock);
+                mutex_unlock(&p_file->follow_lock);
+            }
+        break;
+
+        case AESDCHAR_IOCGETINDEX:
+            PDEBUG("AESDCHAR_IOCGETINDEX\n");
+            if (copy_from_user(&index, (const void __user *)arg, sizeof(index)))
+            {
+                retval = -EFAULT;
+            }
+            else
+            {
+                retval = aesd_get_index(p_dev, &index);
+                // the count and total size are returned along with the entries
+                if ((0 == retval) && copy_to_user((void __user *)arg, &index, sizeof(index)))
+                {
+                    retval = -EFAULT;
+                }
+            }
+        break;
+
+        case AESDCHAR_IOCSEEKTOV:
+            PDEBUG("AESDCHAR_IOCSEEKTOV\n");
+            if (copy_from_user(&seekto_vec, (const void __user *)arg, sizeof(seekto_vec)))
+            {
+                retval = -EFAULT;
+            }
+            else
+            {
+                retval = aesd_seekto_vec(filp, p_dev, &seekto_vec);
             }
         break;
 
@@ -299,6 +945,138 @@ long aesd_ioctl(struct file * filp, unsigned int cmd, unsigned long arg)
     return retval;
 }
 
+/*
+ * Allocates the header page and ring of p_dev on its first mmap and fills them with the
+ * newest history, so devices that are never mapped cost no memory and no copies on write
+ * @return 0, -ENOMEM, -ERESTARTSYS
+ */
+static int aesd_mmap_setup(struct aesd_dev * p_dev)
+{
+    struct aesd_circular_buffer * p_buffer = &p_dev->circular_buffer;
+    struct aesd_mmap_header * p_header;
+    size_t ring_size = PAGE_SIZE;
+    uint64_t head, tail;
+    uint32_t n;
+
+    if (READ_ONCE(p_dev->p_mmap_header) != NULL)
+    {
+        return 0;
+    }
+
+    while (ring_size < mmap_size && ring_size < (1UL << 31))
+    {
+        ring_size <<= 1;
+    }
+    p_header = vmalloc_user(PAGE_SIZE + ring_size);
+    if (p_header == NULL)
+    {
+        printk(KERN_WARNING "Can't map %zu bytes of history\n", ring_size);
+        return -ENOMEM;
+    }
+
+    // acquire lock exclusively, writes publish to the ring once it is installed
+    if (aesd_down_write(p_dev))
+    {
+        vfree(p_header);
+        return -ERESTARTSYS;
+    }
+    if (p_dev->p_mmap_header != NULL)
+    {
+        // mapped concurrently through another file
+        up_write(&p_dev->lock);
+        vfree(p_header);
+        return 0;
+    }
+
+    p_header->ring_size = ring_size;
+    p_header->ring_offset = PAGE_SIZE;
+    p_header->max_entries = p_buffer->max_entries;
+    p_dev->p_mmap_ring = (char *)p_header + PAGE_SIZE;
+    p_dev->p_mmap_header = p_header;
+
+    // only the newest ring_size bytes of the history fit
+    head = p_buffer->base_offset + p_buffer->total_size;
+    tail = (head - p_buffer->base_offset > ring_size) ? head - ring_size : p_buffer->base_offset;
+    for (n = 0; n < p_buffer->count; n++)
+    {
+        uint32_t idx = AESD_CIRCULAR_BUFFER_INDEX(p_buffer, n);
+        uint64_t start = p_buffer->start_offset[idx];
+        const char * p_data = p_buffer->entry[idx].buffptr;
+        size_t size = p_buffer->entry[idx].size;
+
+        if (start + size <= tail)
+        {
+            continue;
+        }
+        if (start < tail)
+        {
+            p_data += tail - start;
+            size -= tail - start;
+            start = tail;
+        }
+        aesd_mmap_copy(p_dev, start, p_data, size);
+    }
+    p_header->tail = tail;
+    p_header->head = head;
+    p_header->total_size = p_buffer->total_size;
+    p_header->count = p_buffer->count;
+    p_header->in_offs = p_buffer->in_offs;
+    p_header->out_offs = p_buffer->out_offs;
+
+    up_write(&p_dev->lock);
+    return 0;
+}
+
+int aesd_mmap(struct file * filp, struct vm_area_struct * vma)
+{
+    PDEBUG("mmap %lu bytes at page %lu\n", vma->vm_end - vma->vm_start, vma->vm_pgoff);
+    struct aesd_dev * p_dev = ((struct aesd_file *)filp->private_data)->p_dev;
+    int result;
+
+    if (mmap_size == 0)
+    {
+        return -ENODEV;
+    }
+
+    // the history is read-only, also for a later mprotect
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    result = aesd_mmap_setup(p_dev);
+    if (result)
+    {
+        return result;
+    }
+
+    // fails if the range reaches past the header page and ring
+    return remap_vmalloc_range(vma, p_dev->p_mmap_header, vma->vm_pgoff);
+}
+
+__poll_t aesd_poll(struct file * filp, poll_table * wait)
+{
+    struct aesd_file * p_file = filp->private_data;
+    struct aesd_dev * p_dev = p_file->p_dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &p_dev->wait_queue, wait);
+
+    // without follow a read never blocks, with it data has to follow the position,
+    // a seek since the last read is left for read to sort out
+    if (!p_file->b_follow || (filp->f_pos != p_file->follow_f_pos) ||
+        (atomic64_read(&p_dev->head) > p_file->follow_pos))
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    return mask;
+}
+
 struct file_operations aesd_fops = {
     .owner =          THIS_MODULE,
     .read =           aesd_read,
@@ -306,41 +1084,238 @@ struct file_operations aesd_fops = {
     .open =           aesd_open,
     .release =        aesd_release,
     .llseek =         aesd_llseek,
-    .unlocked_ioctl = aesd_ioctl
+    .unlocked_ioctl = aesd_ioctl,
+    .mmap =           aesd_mmap,
+    .poll =           aesd_poll
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+/*
+ * Sums the counters of dev over all CPUs into sum, the CPUs keep counting meanwhile
+ */
+static void aesd_stats_sum(struct aesd_dev *dev, struct aesd_stats *sum)
+{
+    unsigned int cpu, idx;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        const struct aesd_stats *cpu_stats = per_cpu_ptr(dev->p_stats, cpu);
+        for (idx = 0; idx < AESD_STAT_COUNT; idx++) {
+            sum->count[idx] += READ_ONCE(cpu_stats->count[idx]);
+        }
+        for (idx = 0; idx < AESD_STORAGE_STAT_COUNT; idx++) {
+            sum->storage[idx] += READ_ONCE(cpu_stats->storage[idx]);
+        }
+    }
+}
+
+static int aesd_stats_show(struct seq_file *s, void *unused)
+{
+    static const char * const stat_names[AESD_STAT_COUNT] = {
+        "bytes_read", "bytes_written", "entries_committed", "entries_evicted",
+        "partial_writes", "lock_contended", "lock_wait_ns", "ioctls"
+    };
+    struct aesd_stats sum;
+    unsigned int idx;
+
+    aesd_stats_sum(s->private, &sum);
+    for (idx = 0; idx < AESD_STAT_COUNT; idx++) {
+        seq_printf(s, "%s %llu\n", stat_names[idx], (unsigned long long)sum.count[idx]);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+static int aesd_storage_show(struct seq_file *s, void *unused)
+{
+    static const char * const stat_names[AESD_STORAGE_STAT_COUNT] = {
+        "pool_hits", "cache_allocs", "kmalloc_allocs", "pool_returns", "frees"
+    };
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats sum;
+    unsigned int idx;
+
+    aesd_stats_sum(dev, &sum);
+    for (idx = 0; idx < AESD_STORAGE_STAT_COUNT; idx++) {
+        seq_printf(s, "%s %llu\n", stat_names[idx], (unsigned long long)sum.storage[idx]);
+    }
+    for (idx = 0; idx < AESD_STORAGE_CLASSES; idx++) {
+        seq_printf(s, "pooled_%zu %u\n", aesd_storage_class_size[idx], READ_ONCE(dev->storage_pool[idx].count));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_storage);
+
+static void aesd_storage_destroy_caches(void)
+{
+    unsigned int class;
+
+    for (class = 0; class < AESD_STORAGE_CLASSES; class++) {
+        kmem_cache_destroy(aesd_storage_cache[class]);
+        aesd_storage_cache[class] = NULL;
+    }
+}
+
+static int aesd_storage_create_caches(void)
+{
+    unsigned int class;
+
+    for (class = 0; class < AESD_STORAGE_CLASSES; class++) {
+        aesd_storage_cache[class] = kmem_cache_create(aesd_storage_class_name[class],
+                aesd_storage_class_size[class], 0, 0, NULL);
+        if (aesd_storage_cache[class] == NULL) {
+            printk(KERN_WARNING "Can't create slab cache %s\n", aesd_storage_class_name[class]);
+            aesd_storage_destroy_caches();
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops); 
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev\n", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u\n", err, index);
     }
     return err;
 }
 
+/*
+ * Sets up the history, lock and counters of a zeroed device
+ */
+static int aesd_dev_init(struct aesd_dev *dev)
+{
+    int result;
+    unsigned int class;
+
+    dev->p_stats = alloc_percpu(struct aesd_stats);
+    if (dev->p_stats == NULL) {
+        return -ENOMEM;
+    }
+    result = aesd_circular_buffer_init_capacity(&dev->circular_buffer, capacity, byte_budget);
+    if (result) {
+        printk(KERN_WARNING "Can't keep %u entries\n", capacity);
+        free_percpu(dev->p_stats);
+        return result;
+    }
+    init_rwsem(&dev->lock);
+    init_waitqueue_head(&dev->wait_queue);
+    for (class = 0; class < AESD_STORAGE_CLASSES; class++) {
+        spin_lock_init(&dev->storage_pool[class].lock);
+    }
+    // the mmap area is allocated by the first aesd_mmap
+    return 0;
+}
+
+/*
+ * Frees everything aesd_dev_init and the writes to the device allocated
+ */
+static void aesd_dev_cleanup(struct aesd_dev *dev)
+{
+    uint32_t index;
+    unsigned int class;
+    struct aesd_buffer_entry *entry;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->circular_buffer,index) {
+        aesd_storage_free(dev, entry->buffptr, entry->size);
+    }
+    for (class = 0; class < AESD_STORAGE_CLASSES; class++) {
+        struct aesd_storage_pool *pool = &dev->storage_pool[class];
+        while (pool->count > 0) {
+            kmem_cache_free(aesd_storage_cache[class], pool->p_free[--pool->count]);
+        }
+    }
+    aesd_circular_buffer_destroy(&dev->circular_buffer);
+    vfree(dev->p_mmap_header);
+    free_percpu(dev->p_stats);
+}
+
+/*
+ * Removes the first count devices, which were fully set up, and the device array
+ */
+static void aesd_remove_devices(unsigned int count)
+{
+    unsigned int index;
+
+    // statistics files go first, they point into the devices
+    debugfs_remove_recursive(aesd_debugfs_root);
+    aesd_debugfs_root = NULL;
+    for (index = 0; index < count; index++) {
+        cdev_del(&aesd_devices[index]->cdev);
+        aesd_dev_cleanup(aesd_devices[index]);
+        kfree(aesd_devices[index]);
+    }
+    kfree(aesd_devices);
+    aesd_devices = NULL;
+}
+
 int __init aesd_init_module(void)
 {
     PDEBUG("init\n");
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int index;
+    char name[16];
+
+    if (nr_devices == 0 || nr_devices > AESD_MAX_DEVICES) {
+        printk(KERN_WARNING "Can't create %u devices\n", nr_devices);
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, nr_devices,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
-    aesd_circular_buffer_init(&aesd_device.circular_buffer); 
-    mutex_init(&aesd_device.lock);
-    result = aesd_setup_cdev(&aesd_device);
+    result = aesd_storage_create_caches();
+    if (result) {
+        unregister_chrdev_region(dev, nr_devices);
+        return result;
+    }
+    aesd_devices = kcalloc(nr_devices, sizeof(struct aesd_dev *), GFP_KERNEL);
+    if (aesd_devices == NULL) {
+        aesd_storage_destroy_caches();
+        unregister_chrdev_region(dev, nr_devices);
+        return -ENOMEM;
+    }
+    // debugfs is optional, its errors are ignored
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+
+    // every device is allocated on its own, so their locks do not share cache lines
+    for (index = 0; index < nr_devices; index++) {
+        struct aesd_dev *p_dev = kzalloc(sizeof(struct aesd_dev), GFP_KERNEL);
+        if (p_dev == NULL) {
+            result = -ENOMEM;
+            break;
+        }
+        result = aesd_dev_init(p_dev);
+        if (result == 0) {
+            result = aesd_setup_cdev(p_dev, index);
+            if (result) {
+                aesd_dev_cleanup(p_dev);
+            }
+        }
+        if (result) {
+            kfree(p_dev);
+            break;
+        }
+        aesd_devices[index] = p_dev;
+
+        snprintf(name, sizeof(name), "aesdchar%u", index);
+        p_dev->p_debugfs_dir = debugfs_create_dir(name, aesd_debugfs_root);
+        debugfs_create_file("storage", 0444, p_dev->p_debugfs_dir, p_dev, &aesd_storage_fops);
+        debugfs_create_file("stats", 0444, p_dev->p_debugfs_dir, p_dev, &aesd_stats_fops);
+    }
     if( result ) {
-        unregister_chrdev_region(dev, 1); 
+        aesd_remove_devices(index);
+        aesd_storage_destroy_caches();
+        unregister_chrdev_region(dev, nr_devices); 
     }
     return result;
 }
@@ -352,16 +1327,10 @@ void __exit aesd_cleanup_module(void)
     PDEBUG("cleanup\n");
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-    int index;
-    struct aesd_buffer_entry *entry;
-
-    // free allocated buffers
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.circular_buffer,index) {
-        kfree(entry->buffptr);
-    }
+    aesd_remove_devices(nr_devices);
+    aesd_storage_destroy_caches();
 
-    cdev_del(&aesd_device.cdev);
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, nr_devices);
 }
 
 module_exit(aesd_cleanup_module);
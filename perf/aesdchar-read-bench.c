@@ -0,0 +1,268 @@
+/*
+ * @file aesdchar-read-bench.c
+ * @brief multi-reader throughput of /dev/aesdchar. Every reader thread opens the
+ * device and reads the whole history from offset 0 over and over for a fixed
+ * time, like concurrent cat processes. Runs once with a single reader and once
+ * with the requested number of readers, and prints full history reads per second
+ * for both, so the scaling of the driver lock with readers is visible. Works on
+ * any readable file, the device has to hold some write commands. With -m the
+ * readers instead scan the history in place through a read-only mmap of the
+ * device, counting its records, and retry scans torn by a concurrent write.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+#define DEFAULT_DEVICE "/dev/aesdchar"
+#define DEFAULT_READERS 4
+#define DEFAULT_SECONDS 2
+#define DEFAULT_READ_SIZE 65536
+#define NSEC_PER_SEC 1000000000ULL
+
+struct reader_s
+{
+    char const * p_path;
+    size_t read_size;
+    uint64_t end_ns;
+    uint64_t reads;
+    uint64_t bytes;
+    uint64_t records;
+    bool b_status;
+    pthread_t tid;
+};
+
+// @brief monotonic time in ns
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// @brief number of '\n' in len bytes at p_data
+static size_t count_records(char const * p_data, size_t len)
+{
+    char const * p_end = p_data + len;
+    size_t records = 0;
+
+    while ((p_data < p_end) && (NULL != (p_data = memchr(p_data, '\n', p_end - p_data))))
+    {
+        p_data++;
+        records++;
+    }
+    return records;
+}
+
+// @brief map the header page and ring of the device read-only
+// @return MAP_FAILED on error
+static void * map_history(const int fd, size_t * const p_map_size)
+{
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    struct aesd_mmap_header const * p_header = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == p_header)
+    {
+        return MAP_FAILED;
+    }
+    *p_map_size = p_header->ring_offset + p_header->ring_size;
+    munmap((void *)p_header, page_size);
+    return mmap(NULL, *p_map_size, PROT_READ, MAP_SHARED, fd, 0);
+}
+
+// @brief scan the mapped history of the device in place until end_ns
+static void * mmap_reader_thread(void * p_arg)
+{
+    struct reader_s * p_reader = p_arg;
+    int fd = open(p_reader->p_path, O_RDONLY);
+    size_t map_size = 0;
+    void * p_map = (-1 != fd) ? map_history(fd, &map_size) : MAP_FAILED;
+    struct aesd_mmap_header const * p_header = p_map;
+
+    p_reader->b_status = (MAP_FAILED != p_map);
+    while (p_reader->b_status && (now_ns() < p_reader->end_ns))
+    {
+        uint32_t seq = __atomic_load_n(&p_header->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        char const * p_ring = (char const *)p_map + p_header->ring_offset;
+        const uint32_t ring_size = p_header->ring_size;
+        uint64_t tail = __atomic_load_n(&p_header->tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&p_header->head, __ATOMIC_RELAXED);
+
+        // the valid bytes wrap around the end of the ring at most once
+        size_t start = tail & (ring_size - 1);
+        size_t first = (head - tail < ring_size - start) ? head - tail : ring_size - start;
+        size_t records = count_records(p_ring + start, first) + count_records(p_ring, head - tail - first);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&p_header->seq, __ATOMIC_RELAXED))
+        {
+            p_reader->reads++;
+            p_reader->bytes += head - tail;
+            p_reader->records += records;
+        }
+    }
+
+    if (MAP_FAILED != p_map)
+    {
+        munmap(p_map, map_size);
+    }
+    if (-1 != fd)
+    {
+        close(fd);
+    }
+    return NULL;
+}
+
+// @brief read the whole file from offset 0 until end_ns
+static void * reader_thread(void * p_arg)
+{
+    struct reader_s * p_reader = p_arg;
+    char * p_buf = malloc(p_reader->read_size);
+    int fd = open(p_reader->p_path, O_RDONLY);
+
+    p_reader->b_status = (NULL != p_buf) && (-1 != fd);
+    while (p_reader->b_status && (now_ns() < p_reader->end_ns))
+    {
+        ssize_t len;
+        if (-1 == lseek(fd, 0, SEEK_SET))
+        {
+            p_reader->b_status = false;
+            break;
+        }
+        while ((len = read(fd, p_buf, p_reader->read_size)) > 0)
+        {
+            p_reader->bytes += len;
+        }
+        if (len < 0)
+        {
+            p_reader->b_status = false;
+            break;
+        }
+        p_reader->reads++;
+    }
+
+    if (-1 != fd)
+    {
+        close(fd);
+    }
+    free(p_buf);
+    return NULL;
+}
+
+// @brief full history reads per second of num_readers concurrent readers, the
+// average size of a history read is stored in p_history_bytes
+// @return -1 if a reader failed
+static double run_readers(char const * const p_path, const bool b_mmap, const int num_readers, const int seconds,
+                          const size_t read_size, double * const p_history_bytes)
+{
+    struct reader_s * p_readers = calloc(num_readers, sizeof(struct reader_s));
+    uint64_t reads = 0;
+    uint64_t bytes = 0;
+    bool b_status = (NULL != p_readers);
+
+    uint64_t start_ns = now_ns();
+    for (int idx = 0; b_status && (idx < num_readers); idx++)
+    {
+        p_readers[idx].p_path = p_path;
+        p_readers[idx].read_size = read_size;
+        p_readers[idx].end_ns = start_ns + (uint64_t)seconds * NSEC_PER_SEC;
+        if (0 != pthread_create(&p_readers[idx].tid, NULL, b_mmap ? mmap_reader_thread : reader_thread,
+                                &p_readers[idx]))
+        {
+            printf("could not start reader %d\n", idx);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int idx = 0; (NULL != p_readers) && (idx < num_readers); idx++)
+    {
+        pthread_join(p_readers[idx].tid, NULL);
+        b_status = b_status && p_readers[idx].b_status;
+        reads += p_readers[idx].reads;
+        bytes += p_readers[idx].bytes;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    *p_history_bytes = (0 != reads) ? (double)bytes / reads : 0;
+    free(p_readers);
+    return b_status ? (double)reads * NSEC_PER_SEC / elapsed_ns : -1;
+}
+
+int main(const int argc, char ** const p_argv)
+{
+    char const * p_path = DEFAULT_DEVICE;
+    int num_readers = DEFAULT_READERS;
+    int seconds = DEFAULT_SECONDS;
+    long read_size = DEFAULT_READ_SIZE;
+    bool b_mmap = false;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, p_argv, "d:t:s:b:m")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 'd':
+                p_path = optarg;
+            break;
+
+            case 't':
+                num_readers = atoi(optarg);
+            break;
+
+            case 's':
+                seconds = atoi(optarg);
+            break;
+
+            case 'b':
+                read_size = atol(optarg);
+            break;
+
+            case 'm':
+                b_mmap = true;
+            break;
+
+            default:
+                printf("Usage: ./aesdchar-read-bench [-d device] [-t readers] [-s seconds] [-b read_size] [-m]\n");
+                exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if ((num_readers < 1) || (seconds < 1) || (read_size < 1))
+    {
+        printf("Usage: ./aesdchar-read-bench [-d device] [-t readers] [-s seconds] [-b read_size] [-m]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double history_bytes = 0;
+    double single_rps = run_readers(p_path, b_mmap, 1, seconds, read_size, &history_bytes);
+    if (single_rps < 0)
+    {
+        printf("could not read %s\n", p_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("device=%s mode=%s read_size=%ld seconds=%d history_bytes=%.0f\n", p_path, b_mmap ? "mmap" : "read",
+           read_size, seconds, history_bytes);
+    printf("read_1reader_rps=%.1f\n", single_rps);
+
+    double multi_rps = run_readers(p_path, b_mmap, num_readers, seconds, read_size, &history_bytes);
+    if (multi_rps < 0)
+    {
+        printf("could not read %s\n", p_path);
+        exit(EXIT_FAILURE);
+    }
+    printf("read_%dreaders_rps=%.1f scaling=%.2f\n", num_readers, multi_rps, multi_rps / single_rps);
+
+    return EXIT_SUCCESS;
+}
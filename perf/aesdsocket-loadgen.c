@@ -0,0 +1,323 @@
+/*
+ * @file aesdsocket-loadgen.c
+ * @brief load generator for aesdsocket. Every worker thread keeps one connection
+ * open (tcp or unix domain socket), sends unique records and measures the time
+ * from sending a record until its writeback, which always ends with that record,
+ * has been received completely. Prints latency percentiles and throughput.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "9000"
+#define DEFAULT_NUM_CONNECTIONS 4
+#define DEFAULT_NUM_RECORDS 100
+#define DEFAULT_RECORD_SIZE 64
+#define MIN_RECORD_SIZE 32
+#define RECV_BUF_LEN 65536
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+struct loadgen_config_s
+{
+    char const * p_host;
+    char const * p_port;
+    char const * p_unix_socket_path;
+    int num_connections;
+    int num_records;
+    int record_size;
+};
+
+struct worker_s
+{
+    struct loadgen_config_s const * p_config;
+    int worker_idx;
+    uint64_t * p_latencies_ns; // one slot per record
+    bool b_status;
+    pthread_t tid;
+};
+
+// @brief monotonic time in ns
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// @brief open a connection to aesdsocket over the transport selected in p_config
+static int connect_to_server(struct loadgen_config_s const * const p_config)
+{
+    int h_sockfd = -1;
+
+    if (NULL != p_config->p_unix_socket_path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", p_config->p_unix_socket_path);
+
+        h_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((-1 != h_sockfd) && (-1 == connect(h_sockfd, (struct sockaddr *)&addr, sizeof(addr))))
+        {
+            fprintf(stderr, "connect to %s failed with error %s\n", addr.sun_path, strerror(errno));
+            close(h_sockfd);
+            h_sockfd = -1;
+        }
+        return h_sockfd;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo * p_result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int return_code = getaddrinfo(p_config->p_host, p_config->p_port, &hints, &p_result);
+    if (return_code != 0)
+    {
+        fprintf(stderr, "getaddrinfo failed with error: %s\n", gai_strerror(return_code));
+        return -1;
+    }
+
+    for (struct addrinfo * p_addr_node = p_result; p_addr_node; p_addr_node = p_addr_node->ai_next)
+    {
+        h_sockfd = socket(p_addr_node->ai_family, p_addr_node->ai_socktype, p_addr_node->ai_protocol);
+        if (-1 == h_sockfd)
+        {
+            continue;
+        }
+        if (0 == connect(h_sockfd, p_addr_node->ai_addr, p_addr_node->ai_addrlen))
+        {
+            break;
+        }
+        close(h_sockfd);
+        h_sockfd = -1;
+    }
+    freeaddrinfo(p_result);
+
+    if (-1 == h_sockfd)
+    {
+        fprintf(stderr, "could not connect to %s:%s\n", p_config->p_host, p_config->p_port);
+    }
+    return h_sockfd;
+}
+
+// @brief fill p_record with a unique newline terminated record of record_size bytes
+static void make_record(char * const p_record, const int record_size, const int worker_idx, const int seq)
+{
+    int len = snprintf(p_record, record_size, "loadgen-%d-%d-", worker_idx, seq);
+    memset(p_record + len, 'x', record_size - len - 1);
+    p_record[record_size - 1] = '\n';
+}
+
+// @brief send every record of this worker and time each full writeback
+static void * worker_thread(void * p_arg)
+{
+    struct worker_s * p_worker = (struct worker_s *)p_arg;
+    struct loadgen_config_s const * p_config = p_worker->p_config;
+    const int record_size = p_config->record_size;
+    char * p_record = malloc(record_size);
+    char * p_tail = malloc(record_size);
+    char * p_recv_buf = malloc(RECV_BUF_LEN);
+
+    p_worker->b_status = false;
+    int h_sockfd = connect_to_server(p_config);
+    if ((-1 == h_sockfd) || (NULL == p_record) || (NULL == p_tail) || (NULL == p_recv_buf))
+    {
+        goto end;
+    }
+
+    for (int seq = 0; seq < p_config->num_records; seq++)
+    {
+        make_record(p_record, record_size, p_worker->worker_idx, seq);
+        memset(p_tail, 0, record_size);
+
+        uint64_t start_ns = now_ns();
+        ssize_t total_sent = 0;
+        while (total_sent < record_size)
+        {
+            ssize_t sent = send(h_sockfd, p_record + total_sent, record_size - total_sent, MSG_NOSIGNAL);
+            if (-1 == sent)
+            {
+                fprintf(stderr, "send failed with error %s\n", strerror(errno));
+                goto end;
+            }
+            total_sent += sent;
+        }
+
+        // the writeback is complete once the stream ends with the record just sent,
+        // only the last record_size bytes received need to be kept to detect that
+        while (0 != memcmp(p_tail, p_record, record_size))
+        {
+            ssize_t received = recv(h_sockfd, p_recv_buf, RECV_BUF_LEN, 0);
+            if (received <= 0)
+            {
+                fprintf(stderr, "recv failed, connection closed before writeback completed\n");
+                goto end;
+            }
+            if (received >= record_size)
+            {
+                memcpy(p_tail, p_recv_buf + received - record_size, record_size);
+            }
+            else
+            {
+                memmove(p_tail, p_tail + received, record_size - received);
+                memcpy(p_tail + record_size - received, p_recv_buf, received);
+            }
+        }
+        p_worker->p_latencies_ns[seq] = now_ns() - start_ns;
+    }
+    p_worker->b_status = true;
+
+    end:
+        if (-1 != h_sockfd)
+        {
+            close(h_sockfd);
+        }
+        free(p_record);
+        free(p_tail);
+        free(p_recv_buf);
+        return NULL;
+}
+
+static int compare_u64(const void * p_a, const void * p_b)
+{
+    uint64_t a = *(const uint64_t *)p_a;
+    uint64_t b = *(const uint64_t *)p_b;
+    return (a > b) - (a < b);
+}
+
+// @brief value at percentile (0-100) of an ascending sorted array
+static uint64_t percentile(uint64_t const * const p_sorted, const size_t count, const double pct)
+{
+    size_t idx = (size_t)((pct / 100.0) * (count - 1) + 0.5);
+    return p_sorted[idx];
+}
+
+// @brief to print help string for application
+static void print_help_str(void)
+{
+    printf("Usage: ./aesdsocket-loadgen [-H host] [-p port] [-u unix_socket_path] [-c connections] [-n records] [-s record_size]\n");
+    printf("-H, -p select the tcp server (default %s:%s), -u uses a unix domain socket instead\n", DEFAULT_HOST, DEFAULT_PORT);
+    printf("-c number of concurrent connections (default %d)\n", DEFAULT_NUM_CONNECTIONS);
+    printf("-n records sent per connection (default %d)\n", DEFAULT_NUM_RECORDS);
+    printf("-s size of each record including the newline (default %d, min %d)\n", DEFAULT_RECORD_SIZE, MIN_RECORD_SIZE);
+}
+
+int main(const int argc, char ** const p_argv)
+{
+    struct loadgen_config_s config = {
+        .p_host = DEFAULT_HOST,
+        .p_port = DEFAULT_PORT,
+        .p_unix_socket_path = NULL,
+        .num_connections = DEFAULT_NUM_CONNECTIONS,
+        .num_records = DEFAULT_NUM_RECORDS,
+        .record_size = DEFAULT_RECORD_SIZE,
+    };
+    int opt_char;
+
+    while ((opt_char = getopt(argc, p_argv, "H:p:u:c:n:s:h")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 'H':
+                config.p_host = optarg;
+            break;
+
+            case 'p':
+                config.p_port = optarg;
+            break;
+
+            case 'u':
+                config.p_unix_socket_path = optarg;
+            break;
+
+            case 'c':
+                config.num_connections = atoi(optarg);
+            break;
+
+            case 'n':
+                config.num_records = atoi(optarg);
+            break;
+
+            case 's':
+                config.record_size = atoi(optarg);
+            break;
+
+            default:
+                print_help_str();
+                exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if ((config.num_connections < 1) || (config.num_records < 1) || (config.record_size < MIN_RECORD_SIZE))
+    {
+        print_help_str();
+        exit(EXIT_FAILURE);
+    }
+
+    const size_t total_records = (size_t)config.num_connections * config.num_records;
+    uint64_t * p_latencies_ns = calloc(total_records, sizeof(uint64_t));
+    struct worker_s * p_workers = calloc(config.num_connections, sizeof(struct worker_s));
+    if ((NULL == p_latencies_ns) || (NULL == p_workers))
+    {
+        fprintf(stderr, "calloc failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start_ns = now_ns();
+    int num_started = 0;
+    for (int idx = 0; idx < config.num_connections; idx++)
+    {
+        p_workers[idx].p_config = &config;
+        p_workers[idx].worker_idx = idx;
+        p_workers[idx].p_latencies_ns = &p_latencies_ns[(size_t)idx * config.num_records];
+        int return_code = pthread_create(&p_workers[idx].tid, NULL, worker_thread, &p_workers[idx]);
+        if (return_code != 0)
+        {
+            fprintf(stderr, "thread create failed with error %s\n", strerror(return_code));
+            break;
+        }
+        num_started++;
+    }
+
+    bool b_status = (num_started == config.num_connections);
+    for (int idx = 0; idx < num_started; idx++)
+    {
+        pthread_join(p_workers[idx].tid, NULL);
+        b_status = b_status && p_workers[idx].b_status;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    if (b_status)
+    {
+        qsort(p_latencies_ns, total_records, sizeof(uint64_t), compare_u64);
+        printf("transport=%s connections=%d records=%zu record_size=%d\n",
+               (NULL != config.p_unix_socket_path) ? "unix" : "tcp",
+               config.num_connections, total_records, config.record_size);
+        printf("p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f\n",
+               (double)percentile(p_latencies_ns, total_records, 50) / NSEC_PER_USEC,
+               (double)percentile(p_latencies_ns, total_records, 90) / NSEC_PER_USEC,
+               (double)percentile(p_latencies_ns, total_records, 99) / NSEC_PER_USEC,
+               (double)p_latencies_ns[total_records - 1] / NSEC_PER_USEC);
+        printf("throughput_rps=%.1f\n", (double)total_records * NSEC_PER_SEC / elapsed_ns);
+    }
+
+    free(p_latencies_ns);
+    free(p_workers);
+    return b_status ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,210 @@
+/*
+ * @file circular-buffer-bench.c
+ * @brief userspace microbenchmark of the aesdchar circular buffer. Times
+ * aesd_circular_buffer_add_entry on a full buffer (the steady state of the driver)
+ * and aesd_circular_buffer_find_entry_offset_for_fpos over every offset of a full
+ * buffer, and aesd_circular_buffer_copy_out reading a whole full buffer in one
+ * call, and prints the average cost per call in ns. find_entry is timed again
+ * on full buffers of each capacity given with -c, sized at runtime, at offsets
+ * spread over the whole buffer.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS 2000000
+#define ENTRY_SIZE 64
+#define NSEC_PER_SEC 1000000000ULL
+#define DEFAULT_CAPACITIES "1024,65536,1048576"
+// coprime with every buffer size, so lookups visit offsets all over the buffer
+#define OFFSET_STRIDE 1000003
+
+// @brief monotonic time in ns
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// @brief fill every slot of p_buffer with an ENTRY_SIZE byte entry from p_data
+static void fill_buffer(struct aesd_circular_buffer * const p_buffer, char const * const p_data)
+{
+    struct aesd_buffer_entry entry = {.buffptr=p_data, .size=ENTRY_SIZE};
+
+    aesd_circular_buffer_init(p_buffer);
+    for (int idx = 0; idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; idx++)
+    {
+        aesd_circular_buffer_add_entry(p_buffer, &entry);
+    }
+}
+
+// @brief time add_entry on an already full buffer
+static double bench_add_entry(char const * const p_data, const long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = {.buffptr=p_data, .size=ENTRY_SIZE};
+
+    fill_buffer(&buffer, p_data);
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        entry.size = ENTRY_SIZE - (idx & 1);
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    return (double)elapsed_ns / iterations;
+}
+
+// @brief time find_entry_offset_for_fpos, sweeping every offset of a full buffer
+static double bench_find_entry(char const * const p_data, const long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    const size_t total_size = (size_t)AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * ENTRY_SIZE;
+    size_t entry_offset = 0;
+    size_t checksum = 0;
+
+    fill_buffer(&buffer, p_data);
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        struct aesd_buffer_entry * p_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, idx % total_size, &entry_offset);
+        checksum += (NULL != p_entry) ? entry_offset : 1;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    // keep the lookups from being optimized away
+    if (checksum == (size_t)-1)
+    {
+        printf("checksum=%zu\n", checksum);
+    }
+    return (double)elapsed_ns / iterations;
+}
+
+// @brief time copy_out of every byte of a full buffer, as one aesd_read call does
+static double bench_copy_out(char const * const p_data, const long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    static char out[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * ENTRY_SIZE];
+    size_t checksum = 0;
+
+    fill_buffer(&buffer, p_data);
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        checksum += aesd_circular_buffer_copy_out(&buffer, 0, out, sizeof(out));
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    if (checksum != sizeof(out) * iterations)
+    {
+        printf("short copy, checksum=%zu\n", checksum);
+    }
+    return (double)elapsed_ns / iterations;
+}
+
+// @brief time find_entry_offset_for_fpos on a full buffer of capacity entries
+// @return -1 if the buffer could not be allocated
+static double bench_find_entry_capacity(char const * const p_data, const size_t capacity, const long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = {.buffptr=p_data, .size=ENTRY_SIZE};
+    const size_t total_size = capacity * ENTRY_SIZE;
+    size_t entry_offset = 0;
+    size_t checksum = 0;
+
+    if (0 != aesd_circular_buffer_init_capacity(&buffer, capacity, 0))
+    {
+        return -1;
+    }
+    for (size_t idx = 0; idx < capacity; idx++)
+    {
+        aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        size_t char_offset = ((size_t)idx * OFFSET_STRIDE) % total_size;
+        struct aesd_buffer_entry * p_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, char_offset, &entry_offset);
+        checksum += (NULL != p_entry) ? entry_offset : 1;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+    aesd_circular_buffer_destroy(&buffer);
+
+    // keep the lookups from being optimized away
+    if (checksum == (size_t)-1)
+    {
+        printf("checksum=%zu\n", checksum);
+    }
+    return (double)elapsed_ns / iterations;
+}
+
+int main(const int argc, char ** const p_argv)
+{
+    long iterations = DEFAULT_ITERATIONS;
+    char const * p_capacities = DEFAULT_CAPACITIES;
+    int opt_char;
+    static char data[ENTRY_SIZE];
+
+    while ((opt_char = getopt(argc, p_argv, "i:c:")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 'i':
+                iterations = atol(optarg);
+            break;
+
+            case 'c':
+                p_capacities = optarg;
+            break;
+
+            default:
+                printf("Usage: ./circular-buffer-bench [-i iterations] [-c capacity[,capacity]...]\n");
+                exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (iterations < 1)
+    {
+        printf("Usage: ./circular-buffer-bench [-i iterations] [-c capacity[,capacity]...]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(data, 'x', sizeof(data));
+    data[ENTRY_SIZE - 1] = '\n';
+
+    printf("entries=%d entry_size=%d iterations=%ld\n", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, ENTRY_SIZE, iterations);
+    printf("add_entry_ns=%.2f\n", bench_add_entry(data, iterations));
+    printf("find_entry_ns=%.2f\n", bench_find_entry(data, iterations));
+    printf("copy_out_all_ns=%.2f\n", bench_copy_out(data, iterations));
+
+    char const * p_pos = p_capacities;
+    while ('\0' != *p_pos)
+    {
+        char * p_end;
+        size_t capacity = strtoul(p_pos, &p_end, 10);
+        if ((p_end == p_pos) || (0 == capacity))
+        {
+            printf("invalid capacity list %s\n", p_capacities);
+            exit(EXIT_FAILURE);
+        }
+
+        double find_ns = bench_find_entry_capacity(data, capacity, iterations);
+        if (find_ns < 0)
+        {
+            printf("could not allocate a buffer of %zu entries\n", capacity);
+            exit(EXIT_FAILURE);
+        }
+        printf("find_entry_cap%zu_ns=%.2f\n", capacity, find_ns);
+        p_pos = (',' == *p_end) ? p_end + 1 : p_end;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#!/bin/bash
+# Performance regression suite for aesdsocket and the aesdchar circular buffer.
+#
+# Each load generator workload runs against a freshly started aesdsocket built
+# in file mode (USE_AESD_CHAR_DEVICE=0), listening on an ephemeral port and
+# storing its data in a temporary directory. The circular buffer
+# microbenchmarks run afterwards. All metrics are written as a flat JSON object
+# and compared with a stored baseline: the suite fails when any metric is worse
+# than its baseline value by more than the threshold percentage. Metrics ending
+# in _rps are higher-is-better, all others are lower-is-better.
+#
+# Usage: ./perf-suite.sh -s aesdsocket -l aesdsocket-loadgen -b circular-buffer-bench
+#                        [-B baseline.json] [-o results.json] [-t threshold_pct] [-u]
+# -u replaces the baseline with the results of this run instead of comparing.
+# Baselines are machine specific, regenerate them with -u on the machine that
+# runs the suite.
+
+cd `dirname $0`
+script_dir=`pwd`
+cd - > /dev/null
+
+aesdsocket=
+loadgen=
+bench=
+baseline=${script_dir}/perf-baseline.json
+results=perf-results.json
+threshold_pct=20
+b_update_baseline=false
+
+while getopts "s:l:b:B:o:t:u" opt_char; do
+    case ${opt_char} in
+        s) aesdsocket=${OPTARG} ;;
+        l) loadgen=${OPTARG} ;;
+        b) bench=${OPTARG} ;;
+        B) baseline=${OPTARG} ;;
+        o) results=${OPTARG} ;;
+        t) threshold_pct=${OPTARG} ;;
+        u) b_update_baseline=true ;;
+        *) echo "invalid option"; exit 1 ;;
+    esac
+done
+
+if [ ! -x "${aesdsocket}" ] || [ ! -x "${loadgen}" ] || [ ! -x "${bench}" ]; then
+    echo "Usage: $0 -s aesdsocket -l aesdsocket-loadgen -b circular-buffer-bench [-B baseline.json] [-o results.json] [-t threshold_pct] [-u]"
+    exit 1
+fi
+
+work_dir=$(mktemp -d)
+server_pid=
+metrics=${work_dir}/metrics.txt
+
+stop_server() {
+    if [ -n "${server_pid}" ]; then
+        kill ${server_pid} 2> /dev/null
+        wait ${server_pid} 2> /dev/null
+        server_pid=
+    fi
+}
+
+cleanup() {
+    stop_server
+    rm -rf ${work_dir}
+}
+trap cleanup EXIT
+
+# @brief start aesdsocket on an ephemeral port, sets server_port
+start_server() {
+    local server_out=${work_dir}/server.out
+    rm -f ${server_out} ${work_dir}/aesdsocketdata
+    ${aesdsocket} -p 0 -f ${work_dir}/aesdsocketdata > ${server_out} &
+    server_pid=$!
+    server_port=
+    for i in $(seq 1 50); do
+        server_port=$(awk '/^listening on port/ {print $4}' ${server_out})
+        [ -n "${server_port}" ] && return
+        sleep 0.1
+    done
+    echo "aesdsocket did not report its port"
+    exit 1
+}
+
+# @brief append key=value metrics printed by a tool to the metrics file, prefixed with name
+collect_metrics() {
+    local name=$1
+    # max and p90 latencies are left out, they are too noisy to gate on
+    tr ' ' '\n' | grep -E '^(p50_us|p99_us|[a-z0-9_]+_(ns|rps))=' | sed "s/^/${name}./" >> ${metrics}
+}
+
+# @brief run one load generator workload against a fresh server
+run_workload() {
+    local name=$1
+    shift
+    echo "== workload ${name}: $*"
+    start_server
+    ${loadgen} -p ${server_port} "$@" > ${work_dir}/${name}.out || { echo "workload ${name} failed"; exit 1; }
+    stop_server
+    cat ${work_dir}/${name}.out
+    collect_metrics ${name} < ${work_dir}/${name}.out
+}
+
+: > ${metrics}
+run_workload tcp_1conn_64b -c 1 -n 2000 -s 64
+run_workload tcp_8conn_64b -c 8 -n 500 -s 64
+run_workload tcp_4conn_1k -c 4 -n 250 -s 1024
+
+echo "== circular buffer microbenchmarks"
+${bench} > ${work_dir}/bench.out || { echo "circular buffer benchmark failed"; exit 1; }
+cat ${work_dir}/bench.out
+collect_metrics circular_buffer < ${work_dir}/bench.out
+
+# write results as a flat JSON object
+awk -F= 'BEGIN {print "{"} {printf "%s  \"%s\": %s", (NR > 1) ? ",\n" : "", $1, $2} END {print "\n}"}' ${metrics} > ${results}
+echo "results written to ${results}"
+
+if ${b_update_baseline}; then
+    cp ${results} ${baseline}
+    echo "baseline ${baseline} updated"
+    exit 0
+fi
+
+if [ ! -f ${baseline} ]; then
+    echo "no baseline at ${baseline}, run with -u to create one"
+    exit 1
+fi
+
+# compare every baseline metric with this run
+awk -v threshold=${threshold_pct} '
+    function parse(line, kv) {
+        if (match(line, /"[^"]+": *[0-9.eE+-]+/)) {
+            split(substr(line, RSTART, RLENGTH), kv, /": */)
+            sub(/^"/, "", kv[1])
+            return 1
+        }
+        return 0
+    }
+    FNR == NR { if (parse($0, kv)) { base[kv[1]] = kv[2] } next }
+    { if (parse($0, kv)) { cur[kv[1]] = kv[2] } }
+    END {
+        failed = 0
+        for (key in base) {
+            if (!(key in cur)) {
+                printf "MISSING %s\n", key
+                failed = 1
+                continue
+            }
+            if (base[key] <= 0) {
+                continue
+            }
+            if (key ~ /_rps$/) {
+                change = (base[key] - cur[key]) * 100.0 / base[key]
+            } else {
+                change = (cur[key] - base[key]) * 100.0 / base[key]
+            }
+            status = (change > threshold) ? "REGRESSION" : "ok"
+            if (change > threshold) {
+                failed = 1
+            }
+            printf "%-10s %-36s baseline=%-12s current=%-12s worse_by=%.1f%%\n", status, key, base[key], cur[key], change
+        }
+        exit failed
+    }' ${baseline} ${results} | sort -k2
+rc=${PIPESTATUS[0]}
+if [ ${rc} -ne 0 ]; then
+    echo "performance regression beyond ${threshold_pct}% threshold"
+else
+    echo "no performance regression beyond ${threshold_pct}% threshold"
+fi
+exit ${rc}
@@ -0,0 +1,172 @@
+/*
+ * @file search-bench.c
+ * @brief userspace microbenchmark of the aesdsocket AESD_SEARCH scan. Builds a
+ * log of random lowercase records, where about one position in 676 shares the
+ * first and last byte of the pattern, times every search variant the cpu
+ * supports and glibc memmem over it, and prints the scan rate in GB/s per core. The parallel
+ * record search is checked against the single threaded one on the same log
+ * and timed as well.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "../server/search.h"
+
+#define DEFAULT_LOG_SIZE (64UL << 20)
+#define DEFAULT_ITERATIONS 10
+#define RECORD_SIZE 64
+#define NSEC_PER_SEC 1000000000ULL
+#define PATTERN "needle-0123456789"
+#define MISSING_PATTERN "needle-not-in-log"
+// every this many records holds the pattern
+#define MATCH_INTERVAL 10007
+
+// @brief monotonic time in ns
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// @brief fill p_log with RECORD_SIZE byte records, a few of which hold PATTERN
+static void fill_log(char * const p_log, const size_t log_size)
+{
+    const size_t pattern_len = strlen(PATTERN);
+    size_t record = 0;
+
+    for (size_t pos = 0; pos + RECORD_SIZE <= log_size; pos += RECORD_SIZE, record++)
+    {
+        for (size_t idx = 0; idx < RECORD_SIZE - 1; idx++)
+        {
+            p_log[pos + idx] = 'a' + (rand() % 26);
+        }
+        if (0 == (record % MATCH_INTERVAL))
+        {
+            memcpy(p_log + pos + 8, PATTERN, pattern_len);
+        }
+        p_log[pos + RECORD_SIZE - 1] = '\n';
+    }
+}
+
+// @brief GB/s of scanning the whole log for a pattern that is not in it with impl,
+// impl SEARCH_IMPL_COUNT times memmem
+static double bench_find(const int impl, char const * const p_log, const size_t log_size, const long iterations)
+{
+    static char const missing_pattern[] = MISSING_PATTERN;
+    size_t checksum = 0;
+
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        char const * p_match = (SEARCH_IMPL_COUNT == impl) ?
+            memmem(p_log, log_size, missing_pattern, strlen(missing_pattern)) :
+            search_find_impl(impl, p_log, log_size, missing_pattern, strlen(missing_pattern));
+        checksum += (NULL != p_match) ? (size_t)(p_match - p_log) : 1;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    // keep the scans from being optimized away
+    if (checksum != (size_t)iterations)
+    {
+        printf("unexpected match, checksum=%zu\n", checksum);
+    }
+    return (double)log_size * iterations / elapsed_ns;
+}
+
+// @brief GB/s of collecting the matching records with up to threads threads,
+// also checks the result against the expected matches
+static double bench_records(char const * const p_log, const size_t log_size, const long iterations,
+                            const unsigned int threads, size_t * const p_count)
+{
+    struct search_result_s result;
+
+    uint64_t start_ns = now_ns();
+    for (long idx = 0; idx < iterations; idx++)
+    {
+        search_records(p_log, log_size, PATTERN, strlen(PATTERN), threads, &result);
+        *p_count = result.count;
+        for (size_t match = 0; match < result.count; match++)
+        {
+            if ((result.p_matches[match].start != match * MATCH_INTERVAL * RECORD_SIZE) ||
+                (result.p_matches[match].end != result.p_matches[match].start + RECORD_SIZE))
+            {
+                printf("wrong match %zu with %u threads\n", match, threads);
+                exit(EXIT_FAILURE);
+            }
+        }
+        search_result_destroy(&result);
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    return (double)log_size * iterations / elapsed_ns;
+}
+
+int main(const int argc, char ** const p_argv)
+{
+    size_t log_size = DEFAULT_LOG_SIZE;
+    long iterations = DEFAULT_ITERATIONS;
+    unsigned int threads = 4;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, p_argv, "s:i:t:")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 's':
+                log_size = strtoul(optarg, NULL, 10) << 20;
+            break;
+
+            case 'i':
+                iterations = atol(optarg);
+            break;
+
+            case 't':
+                threads = atoi(optarg);
+            break;
+
+            default:
+                printf("Usage: ./search-bench [-s log_size_mib] [-i iterations] [-t threads]\n");
+                exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if ((iterations < 1) || (log_size < RECORD_SIZE) || (threads < 1))
+    {
+        printf("Usage: ./search-bench [-s log_size_mib] [-i iterations] [-t threads]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    log_size -= log_size % RECORD_SIZE;
+    char * p_log = malloc(log_size);
+    if (NULL == p_log)
+    {
+        printf("could not allocate %zu bytes\n", log_size);
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    fill_log(p_log, log_size);
+
+    printf("log_size=%zu record_size=%d iterations=%ld\n", log_size, RECORD_SIZE, iterations);
+    for (int impl = 0; impl < SEARCH_IMPL_COUNT; impl++)
+    {
+        if (search_impl_supported(impl))
+        {
+            printf("find_%s_gbps=%.2f\n", search_impl_name(impl), bench_find(impl, p_log, log_size, iterations));
+        }
+    }
+    printf("find_memmem_gbps=%.2f\n", bench_find(SEARCH_IMPL_COUNT, p_log, log_size, iterations));
+
+    size_t count = 0;
+    printf("records_1thread_gbps=%.2f\n", bench_records(p_log, log_size, iterations, 1, &count));
+    printf("records_%uthreads_gbps=%.2f matches=%zu\n", threads,
+           bench_records(p_log, log_size, iterations, threads, &count), count);
+
+    free(p_log);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#!/bin/bash
+# Compare aesdsocket record latency over tcp loopback and over the unix domain
+# socket listener. Runs the load generator with the same workload against a
+# freshly started aesdsocket -u for each transport, so both runs start from the
+# same (empty) log, and prints both results.
+#
+# Like perf-suite.sh the server must be built in file mode (aesdsocket-perf),
+# it listens on an ephemeral port and keeps its data and unix socket in a
+# temporary directory, so a running aesdsocket is left alone.
+#
+# Usage: ./tcp-vs-uds.sh -s aesdsocket -l aesdsocket-loadgen [connections] [records] [record_size]
+
+aesdsocket=
+loadgen=
+
+while getopts "s:l:" opt_char; do
+    case ${opt_char} in
+        s) aesdsocket=${OPTARG} ;;
+        l) loadgen=${OPTARG} ;;
+        *) echo "invalid option"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ ! -x "${aesdsocket}" ] || [ ! -x "${loadgen}" ]; then
+    echo "Usage: $0 -s aesdsocket -l aesdsocket-loadgen [connections] [records] [record_size]"
+    exit 1
+fi
+
+connections=${1:-4}
+records=${2:-100}
+record_size=${3:-64}
+work_dir=$(mktemp -d)
+unix_socket_path=${work_dir}/aesdsocket.sock
+server_pid=
+
+stop_server() {
+    if [ -n "${server_pid}" ]; then
+        kill ${server_pid} 2> /dev/null
+        wait ${server_pid} 2> /dev/null
+        server_pid=
+    fi
+}
+
+cleanup() {
+    stop_server
+    rm -rf ${work_dir}
+}
+trap cleanup EXIT
+
+# @brief start aesdsocket on an ephemeral port and the unix socket, sets server_port
+start_server() {
+    local server_out=${work_dir}/server.out
+    rm -f ${server_out} ${work_dir}/aesdsocketdata ${unix_socket_path}
+    ${aesdsocket} -p 0 -u ${unix_socket_path} -f ${work_dir}/aesdsocketdata > ${server_out} &
+    server_pid=$!
+    server_port=
+    # the unix socket is listening once the tcp port is reported
+    for i in $(seq 1 50); do
+        server_port=$(awk '/^listening on port/ {print $4}' ${server_out})
+        [ -n "${server_port}" ] && return
+        sleep 0.1
+    done
+    echo "aesdsocket did not report its port"
+    exit 1
+}
+
+echo "== tcp loopback"
+start_server
+${loadgen} -p ${server_port} -c ${connections} -n ${records} -s ${record_size} || { echo "tcp run failed"; exit 1; }
+stop_server
+
+echo "== unix domain socket"
+start_server
+${loadgen} -u ${unix_socket_path} -c ${connections} -n ${records} -s ${record_size} || { echo "unix socket run failed"; exit 1; }
+stop_server
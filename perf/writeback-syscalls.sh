@@ -0,0 +1,55 @@
+#!/bin/bash
+# Count the syscalls aesdsocket issues to write back a full aesdchar buffer.
+# Fills the buffer with AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED records, then
+# measures one more record, whose writeback covers all entries of the buffer.
+#
+# Usage: ./writeback-syscalls.sh [host] [port]
+# aesdsocket must already be running (normally with /dev/aesdchar loaded).
+# Uses strace when available, otherwise falls back to the read syscall counter
+# in /proc/<pid>/io, which only covers the storage side of the writeback.
+
+host=${1:-127.0.0.1}
+port=${2:-9000}
+num_entries=10
+
+pid=$(pidof aesdsocket)
+if [ -z "${pid}" ]; then
+    echo "aesdsocket is not running"
+    exit 1
+fi
+
+# @brief send one record on a new connection and wait till it is echoed back
+send_record() {
+    local record=$1
+    local line
+    exec 3<>/dev/tcp/${host}/${port} || exit 1
+    printf '%s\n' "${record}" >&3
+    while read -r -t 5 line <&3; do
+        if [ "${line}" = "${record}" ]; then
+            break
+        fi
+    done
+    exec 3<&-
+}
+
+for i in $(seq 1 ${num_entries}); do
+    send_record "writeback-syscalls fill ${i}"
+done
+
+record="writeback-syscalls measure $$"
+if command -v strace > /dev/null; then
+    strace_out=$(mktemp)
+    strace -f -c -o ${strace_out} -p ${pid} &
+    strace_pid=$!
+    sleep 1
+    send_record "${record}"
+    kill -INT ${strace_pid}
+    wait ${strace_pid}
+    cat ${strace_out}
+    rm -f ${strace_out}
+else
+    syscr_before=$(awk '/^syscr:/ {print $2}' /proc/${pid}/io)
+    send_record "${record}"
+    syscr_after=$(awk '/^syscr:/ {print $2}' /proc/${pid}/io)
+    echo "read syscalls for one ${num_entries} entry writeback: $((syscr_after - syscr_before))"
+fi
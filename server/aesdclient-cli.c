@@ -0,0 +1,138 @@
+/*
+ * @file aesdclient-cli.c
+ * @author krish shah
+ * @brief command line producer for aesdsocket built on aesdclient. Sends every
+ * line read from stdin as a record, pipelined over a pool of connections, and
+ * prints the writebacks to stdout. Lines must not already be in the log, see aesdclient.h
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "aesdclient.h"
+
+#define EXIT_APP_FAILURE (-1)
+
+struct cli_stats_s
+{
+    size_t records_failed;
+};
+
+// @brief to print help string for application
+static void print_help_str(void)
+{
+    printf("Usage: ./aesdclient [-H host] [-p port] [-u unix_socket_path] [-c connections] [-w window]\n");
+    printf("Sends every line of stdin to aesdsocket and prints the writebacks\n");
+    printf("Use optional argument -H and -p to connect to host and port instead of 127.0.0.1:%s\n",
+           AESDCLIENT_DEFAULT_PORT);
+    printf("Use optional argument -u to connect to the unix domain socket at unix_socket_path instead\n");
+    printf("Use optional argument -c to keep connections open instead of %d\n", AESDCLIENT_DEFAULT_POOL_SIZE);
+    printf("Use optional argument -w to send up to window records per connection before waiting for\n");
+    printf("their writebacks instead of %d\n", AESDCLIENT_DEFAULT_MAX_IN_FLIGHT);
+}
+
+// @brief completion callback, prints the writeback
+static void on_complete(void * p_ctx, bool b_ok, char const * p_body, size_t body_len)
+{
+    struct cli_stats_s * p_stats = (struct cli_stats_s *)p_ctx;
+
+    if (!b_ok)
+    {
+        p_stats->records_failed++;
+        return;
+    }
+
+    fwrite(p_body, 1, body_len, stdout);
+}
+
+int main(const int argc, char ** const p_argv)
+{
+    int opt_char;
+    struct aesdclient_config_s config;
+    struct cli_stats_s stats = {0};
+    bool b_status = true;
+
+    aesdclient_config_init(&config);
+
+    while ((opt_char = getopt(argc, p_argv, "H:p:u:c:w:")) != -1)
+    {
+        switch (opt_char)
+        {
+            case 'H':
+                config.p_host = optarg;
+            break;
+
+            case 'p':
+                config.p_port = optarg;
+            break;
+
+            case 'u':
+                config.p_unix_socket_path = optarg;
+            break;
+
+            case 'c':
+                config.pool_size = atoi(optarg);
+            break;
+
+            case 'w':
+                config.max_in_flight = strtoul(optarg, NULL, 10);
+            break;
+
+            default:
+                print_help_str();
+                exit(EXIT_APP_FAILURE);
+            break;
+        }
+    }
+
+    if (optind < argc)
+    {
+        print_help_str();
+        exit(EXIT_APP_FAILURE);
+    }
+
+    struct aesdclient_s * p_client = aesdclient_create(&config);
+    if (NULL == p_client)
+    {
+        fprintf(stderr, "could not connect to aesdsocket\n");
+        exit(EXIT_APP_FAILURE);
+    }
+
+    char * p_line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+    while (-1 != (line_len = getline(&p_line, &line_size, stdin)))
+    {
+        // a last line without newline is still sent as a record
+        if ('\n' != p_line[line_len - 1])
+        {
+            if ((size_t)line_len + 1 >= line_size)
+            {
+                char * p_tmp = realloc(p_line, line_len + 2);
+                if (NULL == p_tmp)
+                {
+                    b_status = false;
+                    break;
+                }
+                p_line = p_tmp;
+                line_size = line_len + 2;
+            }
+            p_line[line_len++] = '\n';
+        }
+
+        if (!aesdclient_append(p_client, p_line, line_len, on_complete, &stats))
+        {
+            fprintf(stderr, "could not send record %.*s", (int)line_len, p_line);
+            b_status = false;
+        }
+    }
+    free(p_line);
+
+    if (!aesdclient_flush(p_client))
+    {
+        b_status = false;
+    }
+    aesdclient_destroy(p_client);
+
+    return (b_status && (0 == stats.records_failed)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,558 @@
+/*
+ * @file aesdclient.c
+ * @author krish shah
+ * @brief client library for aesdsocket producers, see aesdclient.h.
+ * Sockets are non blocking, a connection that cannot take more record bytes
+ * is drained of writebacks meanwhile, so the server never blocks on a full
+ * socket buffer while this side blocks sending
+ */
+#define _GNU_SOURCE
+#include "aesdclient.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define RECV_BUF_LEN 65536
+
+// lines aesdsocket treats as commands are neither appended nor end their writeback
+static char const * const server_cmd_prefixes[] = {"AESD_TAIL:", "AESD_RANGE:", "AESD_FROM:", "AESD_RANGE_TIME:",
+                                                   "AESD_SEARCH:"};
+#define AESDCHAR_IOCSEEKTO_CMD_STR "AESDCHAR_IOCSEEKTO"
+
+// a record sent on a connection, waiting for its writeback
+struct pending_record_s
+{
+    TAILQ_ENTRY(pending_record_s) entries;
+    aesdclient_completion_cb_t cb;
+    void * p_ctx;
+    size_t len;
+    char record[];
+};
+
+TAILQ_HEAD(pending_list_s, pending_record_s);
+
+struct connection_s
+{
+    int h_sockfd;
+    struct pending_list_s pending;
+    size_t num_pending;
+    /**
+     * bytes received since the record before the oldest pending one completed
+     */
+    char * p_resp;
+    size_t resp_len;
+    size_t resp_size;
+};
+
+struct aesdclient_s
+{
+    struct aesdclient_config_s config;
+    struct connection_s * p_connections;
+    char recv_buf[RECV_BUF_LEN];
+};
+
+/**
+ * Fill @param p_config with defaults: localhost:9000, a pool of
+ * AESDCLIENT_DEFAULT_POOL_SIZE connections
+ */
+void aesdclient_config_init(struct aesdclient_config_s * const p_config)
+{
+    memset(p_config, 0, sizeof(*p_config));
+    p_config->p_host = "127.0.0.1";
+    p_config->p_port = AESDCLIENT_DEFAULT_PORT;
+    p_config->pool_size = AESDCLIENT_DEFAULT_POOL_SIZE;
+    p_config->max_in_flight = AESDCLIENT_DEFAULT_MAX_IN_FLIGHT;
+}
+
+// @brief open a non blocking connection to aesdsocket, -1 on failure
+static int connect_to_server(struct aesdclient_config_s const * const p_config)
+{
+    int h_sockfd = -1;
+
+    if (NULL != p_config->p_unix_socket_path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", p_config->p_unix_socket_path);
+
+        h_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((-1 != h_sockfd) && (-1 == connect(h_sockfd, (struct sockaddr *)&addr, sizeof(addr))))
+        {
+            syslog(LOG_ERR, "connect to %s failed with error %s", addr.sun_path, strerror(errno));
+            close(h_sockfd);
+            h_sockfd = -1;
+        }
+    }
+    else
+    {
+        struct addrinfo hints;
+        struct addrinfo * p_result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        int return_code = getaddrinfo(p_config->p_host, p_config->p_port, &hints, &p_result);
+        if (return_code != 0)
+        {
+            syslog(LOG_ERR, "getaddrinfo failed with error: %s", gai_strerror(return_code));
+            return -1;
+        }
+
+        for (struct addrinfo * p_addr_node = p_result; p_addr_node; p_addr_node = p_addr_node->ai_next)
+        {
+            h_sockfd = socket(p_addr_node->ai_family, p_addr_node->ai_socktype, p_addr_node->ai_protocol);
+            if (-1 == h_sockfd)
+            {
+                continue;
+            }
+            if (0 == connect(h_sockfd, p_addr_node->ai_addr, p_addr_node->ai_addrlen))
+            {
+                // pipelined records are small writes with earlier ones still
+                // unacknowledged, nagle would hold each back for a delayed ack
+                int nodelay = 1;
+                if (-1 == setsockopt(h_sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)))
+                {
+                    syslog(LOG_ERR, "setsockopt TCP_NODELAY failed with error %s", strerror(errno));
+                }
+                break;
+            }
+            close(h_sockfd);
+            h_sockfd = -1;
+        }
+        freeaddrinfo(p_result);
+
+        if (-1 == h_sockfd)
+        {
+            syslog(LOG_ERR, "could not connect to %s:%s", p_config->p_host, p_config->p_port);
+        }
+    }
+
+    if ((-1 != h_sockfd) && (-1 == fcntl(h_sockfd, F_SETFL, fcntl(h_sockfd, F_GETFL) | O_NONBLOCK)))
+    {
+        syslog(LOG_ERR, "fcntl failed with error %s", strerror(errno));
+        close(h_sockfd);
+        h_sockfd = -1;
+    }
+
+    return h_sockfd;
+}
+
+// @brief close p_conn and fail every record still waiting on it, the
+// connection is reopened by the next append that picks it
+static void connection_fail(struct connection_s * const p_conn)
+{
+    if (-1 != p_conn->h_sockfd)
+    {
+        close(p_conn->h_sockfd);
+        p_conn->h_sockfd = -1;
+    }
+
+    while (!TAILQ_EMPTY(&p_conn->pending))
+    {
+        struct pending_record_s * p_pending = TAILQ_FIRST(&p_conn->pending);
+        TAILQ_REMOVE(&p_conn->pending, p_pending, entries);
+        if (NULL != p_pending->cb)
+        {
+            p_pending->cb(p_pending->p_ctx, false, NULL, 0);
+        }
+        free(p_pending);
+    }
+    p_conn->num_pending = 0;
+    p_conn->resp_len = 0;
+}
+
+// @brief complete the oldest pending record of p_conn with the first body_end
+// bytes received, and keep the rest for the next record
+static void complete_oldest(struct connection_s * const p_conn, const size_t body_end)
+{
+    struct pending_record_s * p_pending = TAILQ_FIRST(&p_conn->pending);
+    TAILQ_REMOVE(&p_conn->pending, p_pending, entries);
+    p_conn->num_pending--;
+
+    if (NULL != p_pending->cb)
+    {
+        p_pending->cb(p_pending->p_ctx, true, p_conn->p_resp, body_end);
+    }
+    free(p_pending);
+
+    p_conn->resp_len -= body_end;
+    memmove(p_conn->p_resp, p_conn->p_resp + body_end, p_conn->resp_len);
+}
+
+// @brief split the received bytes of p_conn from scan_pos onwards between the
+// pending records. a record completes at the first newline where the bytes
+// received end with it, starting on a line of their own
+static void split_writebacks(struct connection_s * const p_conn, size_t scan_pos)
+{
+    char * p_newline;
+
+    while (!TAILQ_EMPTY(&p_conn->pending) &&
+           (NULL != (p_newline = memchr(p_conn->p_resp + scan_pos, '\n', p_conn->resp_len - scan_pos))))
+    {
+        struct pending_record_s * p_pending = TAILQ_FIRST(&p_conn->pending);
+        size_t line_end = p_newline - p_conn->p_resp + 1;
+        scan_pos = line_end;
+
+        if (line_end < p_pending->len)
+        {
+            continue;
+        }
+        size_t record_start = line_end - p_pending->len;
+        bool b_line_start = (0 == record_start) || ('\n' == p_conn->p_resp[record_start - 1]);
+        if (b_line_start && (0 == memcmp(p_conn->p_resp + record_start, p_pending->record, p_pending->len)))
+        {
+            complete_oldest(p_conn, line_end);
+            scan_pos = 0;
+        }
+    }
+
+    if (TAILQ_EMPTY(&p_conn->pending))
+    {
+        if (0 != p_conn->resp_len)
+        {
+            syslog(LOG_ERR, "dropping %zu bytes received without a pending record", p_conn->resp_len);
+        }
+        p_conn->resp_len = 0;
+    }
+}
+
+// @brief receive whatever p_conn has available without blocking, and complete
+// the records whose writebacks arrived
+// @return false if the connection failed
+static bool connection_receive(struct aesdclient_s * const p_client, struct connection_s * const p_conn)
+{
+    while (-1 != p_conn->h_sockfd)
+    {
+        ssize_t received = recv(p_conn->h_sockfd, p_client->recv_buf, sizeof(p_client->recv_buf), 0);
+        if (-1 == received)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+            {
+                break;
+            }
+            syslog(LOG_ERR, "recv failed with error %s", strerror(errno));
+            connection_fail(p_conn);
+            return false;
+        }
+        else if (0 == received)
+        {
+            syslog(LOG_ERR, "connection closed with %zu records pending", p_conn->num_pending);
+            connection_fail(p_conn);
+            return false;
+        }
+
+        if (p_conn->resp_len + received > p_conn->resp_size)
+        {
+            size_t new_size = (0 == p_conn->resp_size) ? RECV_BUF_LEN : p_conn->resp_size;
+            while (new_size < p_conn->resp_len + received)
+            {
+                new_size *= 2;
+            }
+            char * p_tmp = realloc(p_conn->p_resp, new_size);
+            if (NULL == p_tmp)
+            {
+                syslog(LOG_ERR, "could not grow writeback buffer to %zu bytes", new_size);
+                connection_fail(p_conn);
+                return false;
+            }
+            p_conn->p_resp = p_tmp;
+            p_conn->resp_size = new_size;
+        }
+
+        size_t scan_pos = p_conn->resp_len;
+        memcpy(p_conn->p_resp + p_conn->resp_len, p_client->recv_buf, received);
+        p_conn->resp_len += received;
+        split_writebacks(p_conn, scan_pos);
+    }
+
+    return true;
+}
+
+// @brief wait up to timeout_ms for writebacks on every connection with records
+// pending, and for p_write_conn, if not NULL, to become writable. all connections
+// are drained, a server thread blocked sending to one of them holds the storage
+// lock every other connection waits for
+// @return false if p_write_conn failed, or with p_write_conn NULL, if any connection failed
+static bool pool_wait(struct aesdclient_s * const p_client, struct connection_s * const p_write_conn,
+                      const int timeout_ms)
+{
+    struct pollfd poll_fds[p_client->config.pool_size];
+    struct connection_s * p_poll_conns[p_client->config.pool_size];
+    nfds_t num_fds = 0;
+    bool b_status = true;
+
+    for (int idx = 0; idx < p_client->config.pool_size; idx++)
+    {
+        struct connection_s * p_conn = &p_client->p_connections[idx];
+        if ((-1 != p_conn->h_sockfd) && ((0 != p_conn->num_pending) || (p_conn == p_write_conn)))
+        {
+            poll_fds[num_fds].fd = p_conn->h_sockfd;
+            poll_fds[num_fds].events = POLLIN | ((p_conn == p_write_conn) ? POLLOUT : 0);
+            poll_fds[num_fds].revents = 0;
+            p_poll_conns[num_fds] = p_conn;
+            num_fds++;
+        }
+    }
+
+    if (0 == num_fds)
+    {
+        return NULL == p_write_conn;
+    }
+
+    if (-1 == poll(poll_fds, num_fds, timeout_ms))
+    {
+        if (EINTR == errno)
+        {
+            return true;
+        }
+        syslog(LOG_ERR, "poll failed with error %s", strerror(errno));
+        if (NULL != p_write_conn)
+        {
+            connection_fail(p_write_conn);
+        }
+        return false;
+    }
+
+    for (nfds_t idx = 0; idx < num_fds; idx++)
+    {
+        if ((0 != (poll_fds[idx].revents & (POLLIN | POLLERR | POLLHUP))) &&
+            !connection_receive(p_client, p_poll_conns[idx]) &&
+            ((NULL == p_write_conn) || (p_poll_conns[idx] == p_write_conn)))
+        {
+            b_status = false;
+        }
+    }
+
+    return b_status;
+}
+
+/**
+ * Connect the pool described by @param p_config
+ * @return NULL if not a single connection could be opened
+ */
+struct aesdclient_s * aesdclient_create(struct aesdclient_config_s const * const p_config)
+{
+    int num_connected = 0;
+
+    if ((p_config->pool_size <= 0) || (0 == p_config->max_in_flight))
+    {
+        syslog(LOG_ERR, "pool size and in flight limit must be positive");
+        return NULL;
+    }
+
+    struct aesdclient_s * p_client = calloc(1, sizeof(struct aesdclient_s));
+    if (NULL == p_client)
+    {
+        return NULL;
+    }
+    p_client->config = *p_config;
+    p_client->p_connections = calloc(p_config->pool_size, sizeof(struct connection_s));
+    if (NULL == p_client->p_connections)
+    {
+        free(p_client);
+        return NULL;
+    }
+
+    for (int idx = 0; idx < p_config->pool_size; idx++)
+    {
+        struct connection_s * p_conn = &p_client->p_connections[idx];
+        TAILQ_INIT(&p_conn->pending);
+        p_conn->h_sockfd = connect_to_server(p_config);
+        if (-1 != p_conn->h_sockfd)
+        {
+            num_connected++;
+        }
+    }
+
+    if (0 == num_connected)
+    {
+        aesdclient_destroy(p_client);
+        return NULL;
+    }
+    return p_client;
+}
+
+/**
+ * Close the pool. Records still in flight are failed, call
+ * aesdclient_flush first to wait for them
+ */
+void aesdclient_destroy(struct aesdclient_s * const p_client)
+{
+    for (int idx = 0; idx < p_client->config.pool_size; idx++)
+    {
+        connection_fail(&p_client->p_connections[idx]);
+        free(p_client->p_connections[idx].p_resp);
+    }
+    free(p_client->p_connections);
+    free(p_client);
+}
+
+// @brief the connected connection with the fewest records in flight,
+// reconnecting closed ones on the way, NULL if none can be connected
+static struct connection_s * pick_connection(struct aesdclient_s * const p_client)
+{
+    struct connection_s * p_best = NULL;
+
+    for (int idx = 0; idx < p_client->config.pool_size; idx++)
+    {
+        struct connection_s * p_conn = &p_client->p_connections[idx];
+        if (-1 == p_conn->h_sockfd)
+        {
+            p_conn->h_sockfd = connect_to_server(&p_client->config);
+            if (-1 == p_conn->h_sockfd)
+            {
+                continue;
+            }
+        }
+        if ((NULL == p_best) || (p_conn->num_pending < p_best->num_pending))
+        {
+            p_best = p_conn;
+        }
+    }
+
+    return p_best;
+}
+
+/**
+ * Send the record of @param len bytes at @param p_record on the least loaded
+ * connection, without waiting for its writeback. It must be a single line ending
+ * in a newline, and not an aesdsocket command. @param cb, if not NULL, is called
+ * with @param p_ctx once the writeback arrived or the connection failed.
+ * Blocks only while the connection has max_in_flight records pending or
+ * cannot take more bytes.
+ * @return false if the record was rejected, @param cb is not called then, or if
+ * the connection failed while sending it, @param cb was called with b_ok false
+ */
+bool aesdclient_append(struct aesdclient_s * const p_client, char const * const p_record, const size_t len,
+                       aesdclient_completion_cb_t cb, void * const p_ctx)
+{
+    if ((0 == len) || ('\n' != p_record[len - 1]) || (NULL != memchr(p_record, '\n', len - 1)) ||
+        (NULL != memmem(p_record, len, AESDCHAR_IOCSEEKTO_CMD_STR, strlen(AESDCHAR_IOCSEEKTO_CMD_STR))))
+    {
+        return false;
+    }
+    for (size_t idx = 0; idx < sizeof(server_cmd_prefixes) / sizeof(server_cmd_prefixes[0]); idx++)
+    {
+        if (0 == strncmp(p_record, server_cmd_prefixes[idx], strlen(server_cmd_prefixes[idx])))
+        {
+            return false;
+        }
+    }
+
+    struct connection_s * p_conn = pick_connection(p_client);
+    if (NULL == p_conn)
+    {
+        return false;
+    }
+
+    while (p_conn->num_pending >= p_client->config.max_in_flight)
+    {
+        pool_wait(p_client, NULL, -1);
+    }
+    if (-1 == p_conn->h_sockfd)
+    {
+        return false;
+    }
+
+    struct pending_record_s * p_pending = malloc(sizeof(struct pending_record_s) + len);
+    if (NULL == p_pending)
+    {
+        return false;
+    }
+    p_pending->cb = cb;
+    p_pending->p_ctx = p_ctx;
+    p_pending->len = len;
+    memcpy(p_pending->record, p_record, len);
+
+    // queue before sending, the writeback may arrive while later bytes are still sent
+    TAILQ_INSERT_TAIL(&p_conn->pending, p_pending, entries);
+    p_conn->num_pending++;
+
+    size_t total_sent = 0;
+    while (total_sent < len)
+    {
+        ssize_t sent = send(p_conn->h_sockfd, p_record + total_sent, len - total_sent, MSG_NOSIGNAL);
+        if (-1 == sent)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+            {
+                // a failed wait already failed this record with the connection
+                if (!pool_wait(p_client, p_conn, -1))
+                {
+                    return false;
+                }
+                continue;
+            }
+            syslog(LOG_ERR, "send failed with error %s", strerror(errno));
+            connection_fail(p_conn);
+            return false;
+        }
+        total_sent += sent;
+    }
+
+    return true;
+}
+
+/**
+ * Receive writebacks on every connection and run completion callbacks,
+ * waiting up to @param timeout_ms (-1 forever, 0 not at all) for data
+ * @return false if a connection failed
+ */
+bool aesdclient_poll(struct aesdclient_s * const p_client, const int timeout_ms)
+{
+    return pool_wait(p_client, NULL, timeout_ms);
+}
+
+/**
+ * Wait till every record sent so far has completed
+ * @return false if a connection failed, its records completed with b_ok false
+ */
+bool aesdclient_flush(struct aesdclient_s * const p_client)
+{
+    bool b_status = true;
+
+    while (0 != aesdclient_in_flight(p_client))
+    {
+        if (!aesdclient_poll(p_client, -1))
+        {
+            b_status = false;
+        }
+    }
+
+    return b_status;
+}
+
+/**
+ * @return records sent whose writeback has not arrived yet
+ */
+size_t aesdclient_in_flight(struct aesdclient_s const * const p_client)
+{
+    size_t in_flight = 0;
+
+    for (int idx = 0; idx < p_client->config.pool_size; idx++)
+    {
+        in_flight += p_client->p_connections[idx].num_pending;
+    }
+
+    return in_flight;
+}
@@ -0,0 +1,76 @@
+/*
+ * @file aesdclient.h
+ * @author krish shah
+ * @brief client library for aesdsocket producers. Keeps a pool of persistent
+ * connections, pipelines records on them without waiting for each writeback,
+ * and reports every record through a completion callback once it was committed.
+ *
+ * aesdsocket writebacks carry no length or delimiter, so this is not a general
+ * client. It relies on aesdsocket writing back after committing, under the same
+ * lock, so the bytes written back for a record end with that record on a line
+ * of its own. The body reported for a record is what the connection received
+ * since the previous record completed, up to and including the record; records
+ * the server received together and wrote back once split that writeback between
+ * them. A record is recognised by its contents, so records must not already be
+ * in the log, e.g. by carrying a producer id and sequence number like the
+ * records of aesdsocket-loadgen. A record identical to a line still in the log
+ * would be matched there, and completed before the server committed it.
+ *
+ * The library is single threaded. Callbacks run from within aesdclient_append,
+ * aesdclient_poll and aesdclient_flush, and must not call back into the
+ * library. Records on one connection complete in order, records spread across
+ * the pool may be committed in any order.
+ */
+#ifndef AESDSOCKET_AESDCLIENT_H
+#define AESDSOCKET_AESDCLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AESDCLIENT_DEFAULT_PORT "9000"
+#define AESDCLIENT_DEFAULT_POOL_SIZE 4
+#define AESDCLIENT_DEFAULT_MAX_IN_FLIGHT 64
+
+struct aesdclient_s;
+
+/**
+ * Called once per record. @param b_ok is false if the connection failed before
+ * the writeback arrived, @param p_body is then NULL. @param p_body is only valid
+ * during the call.
+ */
+typedef void (*aesdclient_completion_cb_t)(void * p_ctx, bool b_ok, char const * p_body, size_t body_len);
+
+struct aesdclient_config_s
+{
+    /**
+     * server to connect to, p_unix_socket_path takes precedence over p_host
+     */
+    char const * p_host;
+    char const * p_port;
+    char const * p_unix_socket_path;
+    /**
+     * number of persistent connections, records go to the least loaded one
+     */
+    int pool_size;
+    /**
+     * records sent on a connection before waiting for their writebacks
+     */
+    size_t max_in_flight;
+};
+
+extern void aesdclient_config_init(struct aesdclient_config_s * const p_config);
+
+extern struct aesdclient_s * aesdclient_create(struct aesdclient_config_s const * const p_config);
+
+extern void aesdclient_destroy(struct aesdclient_s * const p_client);
+
+extern bool aesdclient_append(struct aesdclient_s * const p_client, char const * const p_record, const size_t len,
+                              aesdclient_completion_cb_t cb, void * const p_ctx);
+
+extern bool aesdclient_poll(struct aesdclient_s * const p_client, const int timeout_ms);
+
+extern bool aesdclient_flush(struct aesdclient_s * const p_client);
+
+extern size_t aesdclient_in_flight(struct aesdclient_s const * const p_client);
+
+#endif /* AESDSOCKET_AESDCLIENT_H */
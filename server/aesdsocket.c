@@ -4,28 +4,47 @@
  * @date 2025-02-22
  * @brief opens a socket connection on port 9000, and receives bytes from it
  * till a \n is received. After that, it appends data to a file (/var/tmp/aesdsocketdata)
- * and reads all content from that file and writes it back on the socket connection
+ * and reads all content from that file and writes it back on the socket connection.
+ * Lines of the form AESD_TAIL:n, AESD_RANGE:i,j and AESD_FROM:offset are not
+ * appended, they write back only the last n records, records i to j (0 is the
+ * oldest) or everything from byte offset onwards
  */
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/queue.h>
 #include <sys/ioctl.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <netdb.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
-
+#include "placement.h"
+#include "stats.h"
+#include "buf_pool.h"
+#include "sched.h"
+#include "probes.h"
+#include "record_index.h"
+#include "snapshot.h"
+#include "outq.h"
+#include "search.h"
+
+#ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1
+#endif
 #if USE_AESD_CHAR_DEVICE == 1
 #define SOCKET_DATA_FILE_PATHNAME "/dev/aesdchar"
 #else
@@ -41,12 +60,30 @@
 #define MAX_TIMESTAMP_LEN 995
 #define AESDCHAR_IOCSEEKTO_CMD_STR "AESDCHAR_IOCSEEKTO"
 #define AESDCHAR_IOCSEEKTO_FMT_STR "AESDCHAR_IOCSEEKTO:%u,%u"
+#define CLIENT_ADDR_STR_LEN INET6_ADDRSTRLEN
+#define UNIX_SOCKET_CLIENT_STR "unix-socket"
+#define READ_CMD_PREFIX_STR "AESD_"
+#define READ_TAIL_PREFIX_STR "AESD_TAIL:"
+#define READ_RANGE_PREFIX_STR "AESD_RANGE:"
+#define READ_FROM_PREFIX_STR "AESD_FROM:"
+#define READ_RANGE_TIME_PREFIX_STR "AESD_RANGE_TIME:"
+#define READ_SEARCH_PREFIX_STR "AESD_SEARCH:"
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define INDEX_LOAD_BUF_LEN 4096
 
 struct thread_args_s
 {
-    struct sockaddr_in remote_client_address;
+    struct sockaddr_storage remote_client_address;
     pthread_mutex_t * p_mutex;
     int h_recvfd;
+    int numa_node;
+    struct sched_client_s sched_client;
+    struct outq_s outq;
+#if USE_AESD_CHAR_DEVICE != 1
+    // sidecar entry of the records committed on this connection
+    struct record_meta_s record_meta;
+#endif
     bool b_is_thread_complete;
     pthread_t tid;
 };
@@ -57,12 +94,63 @@ struct slist_entry_s
     SLIST_ENTRY(slist_entry_s) slist_entries;
 };
 
+// buffer the storage contents are read into for a writeback, owned by a single
+// service thread till it is handed to its output queue, allocated from buf_pool
+struct writeback_buf_s
+{
+    char * p_buf;
+    size_t buf_size;
+};
+
+enum read_cmd_type_e
+{
+    READ_CMD_TAIL,
+    READ_CMD_RANGE,
+    READ_CMD_FROM,
+    READ_CMD_RANGE_TIME,
+    READ_CMD_SEARCH,
+};
+
+// a parsed AESD_TAIL, AESD_RANGE, AESD_FROM, AESD_RANGE_TIME or AESD_SEARCH line
+struct read_cmd_s
+{
+    enum read_cmd_type_e type;
+    unsigned long long arg1;
+    unsigned long long arg2;
+    // AESD_SEARCH pattern, points into the line that was parsed
+    char const * p_pattern;
+    size_t pattern_len;
+};
+
 SLIST_HEAD(slist_head_s, slist_entry_s);
+
+AESD_PROBE_SEMAPHORE(accept);
+AESD_PROBE_SEMAPHORE(recv);
+AESD_PROBE_SEMAPHORE(record_complete);
+AESD_PROBE_SEMAPHORE(lock_acquire);
+AESD_PROBE_SEMAPHORE(lock_acquired);
+AESD_PROBE_SEMAPHORE(store_append);
+AESD_PROBE_SEMAPHORE(writeback_start);
+AESD_PROBE_SEMAPHORE(writeback_end);
+AESD_PROBE_SEMAPHORE(lock_release);
+AESD_PROBE_SEMAPHORE(close);
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static volatile bool b_accept_connections = true;
+static volatile bool b_log_stats = false;
+// storage path, defaults to SOCKET_DATA_FILE_PATHNAME, can be changed with -f
+static char const * p_socket_data_file_pathname = SOCKET_DATA_FILE_PATHNAME;
+// output queue watermarks and slow consumer policy, set once by main
+static struct outq_config_s outq_config;
+#if USE_AESD_CHAR_DEVICE != 1
+// records in the data file, and a copy of it shared by writebacks, protected by mutex
+static struct record_index_s record_index;
+static struct snapshot_cache_s snapshot_cache;
+// set under mutex once the timer is deleted, so a late callback leaves them alone
+static bool b_timer_stopped = false;
+#endif
 
 // @brief signal handler to redirect SIGINT and SIGTERM 
-// to gracefully exit application
+// to gracefully exit application, and SIGUSR1 to log stats
 static void signal_handler(int signo)
 {
     if ((SIGINT == signo) || SIGTERM == signo)
@@ -70,6 +158,10 @@ static void signal_handler(int signo)
         syslog(LOG_DEBUG, "Caught signal, exiting");
         b_accept_connections = false;
     }
+    else if (SIGUSR1 == signo)
+    {
+        b_log_stats = true;
+    }
 }
 
 // @brief bind to given node and service 
@@ -137,6 +229,69 @@ static bool bind_to_address(char const * const p_node, char const * const p_serv
     return b_status;
 }
 
+// @brief create a unix domain stream socket bound to p_path, any stale
+// socket file left behind at p_path is removed first
+static bool bind_to_unix_path(char const * const p_path, int * const p_socket_fd)
+{
+    struct sockaddr_un addr;
+    bool b_status = true;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(p_path) >= sizeof(addr.sun_path))
+    {
+        syslog(LOG_ERR, "unix socket path %s is too long", p_path);
+        return false;
+    }
+    strcpy(addr.sun_path, p_path);
+
+    int h_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == h_sockfd)
+    {
+        syslog(LOG_ERR, "socket failed with error: %s\n", strerror(errno));
+        b_status = false;
+    }
+    else
+    {
+        if ((-1 == unlink(p_path)) && (ENOENT != errno))
+        {
+            syslog(LOG_ERR, "unlink of stale %s failed with error: %s\n", p_path, strerror(errno));
+        }
+
+        if (-1 == bind(h_sockfd, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+            syslog(LOG_ERR, "bind failed with error: %s\n", strerror(errno));
+            close(h_sockfd);
+            h_sockfd = -1;
+            b_status = false;
+        }
+    }
+
+    *p_socket_fd = h_sockfd;
+    return b_status;
+}
+
+// @brief report the port the tcp listener was bound to, used when an ephemeral
+// port was requested so that scripts starting aesdsocket can find it
+static void print_bound_port(const int h_sockfd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_size = sizeof(addr);
+
+    if (-1 == getsockname(h_sockfd, (struct sockaddr *)&addr, &addr_size))
+    {
+        syslog(LOG_ERR, "getsockname failed with error: %s\n", strerror(errno));
+    }
+    else
+    {
+        unsigned int port = (AF_INET6 == addr.ss_family) ? ntohs(((struct sockaddr_in6 *)&addr)->sin6_port)
+                                                         : ntohs(((struct sockaddr_in *)&addr)->sin_port);
+        syslog(LOG_DEBUG, "listening on port %u", port);
+        printf("listening on port %u\n", port);
+        fflush(stdout);
+    }
+}
+
 // @brief open the socket data file for appending received data
 static bool open_socket_data_file(char const * const p_pathname, FILE ** const pph_socket_data_file)
 {
@@ -153,7 +308,7 @@ static bool open_socket_data_file(char const * const p_pathname, FILE ** const p
     return b_status;
 }
 
-// @brief redirect SIGINT and SIGTERM to signal handler
+// @brief redirect SIGINT, SIGTERM and SIGUSR1 to signal handler
 static bool assign_signal_handler(void)
 {
     bool b_status = true;
@@ -172,271 +327,1057 @@ static bool assign_signal_handler(void)
         b_status = false;
     }
 
+    if (-1 == sigaction(SIGUSR1, &action, NULL))
+    {
+        syslog(LOG_ERR, "could not set sigaction for SIGUSR1 with error %s", strerror(errno));
+        b_status = false;
+    }
+
     return b_status;
 }
 
-// @brief read contents of socket data file and send it back over socket connection
-static bool writeback(FILE * const ph_socket_data_file, const int h_recvfd)
+// @brief make sure p_wb_buf can hold at least required_size bytes, keeping
+// the first used bytes
+static bool reserve_writeback_buf(struct writeback_buf_s * const p_wb_buf, const size_t used, const size_t required_size)
 {
-    // loop till eof, then break 
-    ssize_t line_size = 0;
-    size_t len = 0;
-    char * p_line = NULL;
     bool b_status = true;
-    bool b_send_fail = false;
-
-    // set file offet to 0 before reading
 
-#if USE_AESD_CHAR_DEVICE != 1
-    if (-1 == fseek(ph_socket_data_file, 0, SEEK_SET))
+    char * p_tmp = buf_pool_grow(p_wb_buf->p_buf, used, &p_wb_buf->buf_size, required_size);
+    if (NULL == p_tmp)
     {
-        syslog(LOG_ERR, "fseek set failed with error %s", strerror(errno));
+        syslog(LOG_ERR, "could not grow writeback buffer to %zu bytes", required_size);
         b_status = false;
     }
     else
-#endif
     {
-        while (!b_send_fail)
+        p_wb_buf->p_buf = p_tmp;
+    }
+
+    return b_status;
+}
+
+// @brief read everything from start_pos to eof of storage fd into p_wb_buf.
+// the size left to read is queried up front, so the data is pulled in with as
+// few large reads as the storage allows
+static bool read_storage(const int fd, const off_t start_pos, struct writeback_buf_s * const p_wb_buf,
+                         size_t * const p_bytes_read)
+{
+    bool b_status = true;
+    size_t bytes_read = 0;
+
+    // ask the storage for its size, this is only a sizing hint, reads below
+    // continue till eof, so a failing SEEK_END is not fatal
+    off_t end_pos = lseek(fd, 0, SEEK_END);
+    if (-1 == lseek(fd, start_pos, SEEK_SET))
+    {
+        syslog(LOG_ERR, "lseek set failed with error %s", strerror(errno));
+        return false;
+    }
+
+    // +1 so the final read that reports eof does not force a grow
+    size_t size_hint = (end_pos > start_pos) ? (size_t)(end_pos - start_pos) + 1 : 1;
+    if (!reserve_writeback_buf(p_wb_buf, 0, size_hint))
+    {
+        return false;
+    }
+
+    // loop till eof, aesdchar copies as many consecutive entries as fit in a read,
+    // but a read can still return less than asked, e.g. when interrupted
+    while (true)
+    {
+        if ((bytes_read == p_wb_buf->buf_size) && !reserve_writeback_buf(p_wb_buf, bytes_read, bytes_read + 1))
+        {
+            b_status = false;
+            break;
+        }
+
+        ssize_t read_size = read(fd, p_wb_buf->p_buf + bytes_read, p_wb_buf->buf_size - bytes_read);
+        stats_add(STAT_STORAGE_READS, 1);
+        if (-1 == read_size)
         {
-            line_size = getline(&p_line, &len, ph_socket_data_file);
-            if (-1 == line_size)
+            if (EINTR == errno)
             {
-                // failure to read, can be due to EOF, exit
-                break;
+                continue;
             }
+            syslog(LOG_ERR, "read failed with error %s", strerror(errno));
+            b_status = false;
+            break;
+        }
+        else if (0 == read_size)
+        {
+            break;
+        }
+        bytes_read += read_size;
+    }
+
+    *p_bytes_read = bytes_read;
+    return b_status;
+}
+
+// @brief read contents of socket data file, to be written back over the socket
+// connection, into the per thread p_wb_buf
+static bool read_writeback(FILE * const ph_socket_data_file, struct writeback_buf_s * const p_wb_buf,
+                           size_t * const p_bytes_read)
+{
+    bool b_status = true;
+    size_t bytes_read = 0;
+    off_t start_pos = 0;
+
+    int fd = fileno(ph_socket_data_file);
+    if (-1 == fd)
+    {
+        syslog(LOG_ERR, "fileno failed with error %s", strerror(errno));
+        return false;
+    }
+
+    // data appended with fprintf may still sit in the stdio buffer, push it to storage
+    // before reading through the file descriptor
+    if (EOF == fflush(ph_socket_data_file))
+    {
+        syslog(LOG_ERR, "fflush failed with error %s", strerror(errno));
+    }
 
-            int bytes_written = 0;
-            int total_bytes_written = 0;
-            while (total_bytes_written < line_size)
+#if USE_AESD_CHAR_DEVICE != 1
+    // set file offet to 0 before reading
+    start_pos = 0;
+#else
+    // start from wherever the last AESDCHAR_IOCSEEKTO left the file position
+    start_pos = lseek(fd, 0, SEEK_CUR);
+    if (-1 == start_pos)
+    {
+        syslog(LOG_ERR, "lseek cur failed with error %s", strerror(errno));
+        start_pos = 0;
+    }
+#endif
+
+    // everything that was read is written back, even if a later read failed
+    b_status = read_storage(fd, start_pos, p_wb_buf, &bytes_read);
+    *p_bytes_read = bytes_read;
+
+    return b_status;
+}
+
+// @brief hand len bytes at offset of p_wb_buf to the output queue of the
+// connection, the next writeback reads into a fresh buffer from the pool
+static void queue_writeback_buf(struct thread_args_s * const p_thread_args, struct writeback_buf_s * const p_wb_buf,
+                                const size_t offset, const size_t len)
+{
+    if (0 == len)
+    {
+        return;
+    }
+
+    if (!outq_push_block(&p_thread_args->outq, p_wb_buf->p_buf, p_wb_buf->buf_size, offset, len))
+    {
+        syslog(LOG_ERR, "could not queue writeback of %zu bytes", len);
+    }
+    p_wb_buf->p_buf = NULL;
+    p_wb_buf->buf_size = 0;
+}
+
+// @brief parse the decimal number at *pp_pos and advance *pp_pos past it. Unlike
+// sscanf %llu no sign or leading whitespace is accepted, so "-1" is not ULLONG_MAX
+// @return false if there is no number at *pp_pos or it does not fit
+static bool parse_decimal(char const ** const pp_pos, unsigned long long * const p_value)
+{
+    char * p_end;
+
+    if ((**pp_pos < '0') || (**pp_pos > '9'))
+    {
+        return false;
+    }
+    errno = 0;
+    *p_value = strtoull(*pp_pos, &p_end, 10);
+    if (ERANGE == errno)
+    {
+        return false;
+    }
+    *pp_pos = p_end;
+    return true;
+}
+
+// @brief parse p_line, a null terminated line including its newline, as a read command
+// @return false if p_line is not a well formed read command, it is then a regular record
+static bool parse_read_cmd(char const * const p_line, struct read_cmd_s * const p_cmd)
+{
+    static const struct
+    {
+        char const * p_prefix;
+        enum read_cmd_type_e type;
+        int num_args;
+    } read_cmds[] = {
+        {READ_TAIL_PREFIX_STR, READ_CMD_TAIL, 1},
+        {READ_RANGE_PREFIX_STR, READ_CMD_RANGE, 2},
+        {READ_FROM_PREFIX_STR, READ_CMD_FROM, 1},
+        {READ_RANGE_TIME_PREFIX_STR, READ_CMD_RANGE_TIME, 2},
+    };
+    char const * p_pos = NULL;
+
+    // regular records are rejected without going through sscanf
+    if (0 != strncmp(p_line, READ_CMD_PREFIX_STR, strlen(READ_CMD_PREFIX_STR)))
+    {
+        return false;
+    }
+
+    // the pattern is the rest of the line, without its newline
+    if (0 == strncmp(p_line, READ_SEARCH_PREFIX_STR, strlen(READ_SEARCH_PREFIX_STR)))
+    {
+        p_cmd->type = READ_CMD_SEARCH;
+        p_cmd->p_pattern = p_line + strlen(READ_SEARCH_PREFIX_STR);
+        p_cmd->pattern_len = strlen(p_cmd->p_pattern) - 1;
+        return p_cmd->pattern_len > 0;
+    }
+
+    for (size_t idx = 0; idx < sizeof(read_cmds) / sizeof(read_cmds[0]); idx++)
+    {
+        if (0 == strncmp(p_line, read_cmds[idx].p_prefix, strlen(read_cmds[idx].p_prefix)))
+        {
+            p_cmd->type = read_cmds[idx].type;
+            p_pos = p_line + strlen(read_cmds[idx].p_prefix);
+            if (!parse_decimal(&p_pos, &p_cmd->arg1) ||
+                ((2 == read_cmds[idx].num_args) && ((',' != *p_pos++) || !parse_decimal(&p_pos, &p_cmd->arg2))))
             {
-                bytes_written = send(h_recvfd, p_line + total_bytes_written, line_size - total_bytes_written, MSG_NOSIGNAL);
-                if (-1 == bytes_written)
-                {
-                    // send failed
-                    syslog(LOG_ERR, "send failed with error %s", strerror(errno));
-                    b_send_fail = true;
-                    b_status = false;
-                    break;
-                }
-                total_bytes_written += bytes_written;
+                return false;
             }
+            break;
+        }
+    }
+    if (NULL == p_pos)
+    {
+        return false;
+    }
+
+    // the whole line must be the command, up to trailing whitespace
+    while (isspace((unsigned char)*p_pos))
+    {
+        p_pos++;
+    }
+    return '\0' == *p_pos;
+}
+
+// @brief CLOCK_MONOTONIC time of unix time unix_ms, records are indexed by the
+// monotonic clock so steps of the wall clock do not reorder them
+static uint64_t unix_ms_to_monotonic_ns(const unsigned long long unix_ms)
+{
+    struct timespec realtime;
+    struct timespec monotonic;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    uint64_t boot_unix_ns = (realtime.tv_sec * NSEC_PER_SEC + realtime.tv_nsec) -
+                            (monotonic.tv_sec * NSEC_PER_SEC + monotonic.tv_nsec);
+
+    if (unix_ms > UINT64_MAX / NSEC_PER_MSEC)
+    {
+        return UINT64_MAX;
+    }
+    uint64_t unix_ns = unix_ms * NSEC_PER_MSEC;
+    return (unix_ns > boot_unix_ns) ? unix_ns - boot_unix_ns : 0;
+}
+
+// @brief byte range of p_index that read command p_cmd selects
+// @return false if no record matches
+static bool locate_records(struct record_index_s const * const p_index, struct read_cmd_s const * const p_cmd,
+                           uint64_t * const p_start_offset, uint64_t * const p_end_offset)
+{
+    bool b_found = false;
+
+    switch (p_cmd->type)
+    {
+        case READ_CMD_TAIL:
+            b_found = record_index_tail(p_index, p_cmd->arg1, p_start_offset, p_end_offset);
+        break;
+
+        case READ_CMD_RANGE:
+            b_found = record_index_range(p_index, p_cmd->arg1, p_cmd->arg2, p_start_offset, p_end_offset);
+        break;
+
+        case READ_CMD_FROM:
+            b_found = record_index_from(p_index, p_cmd->arg1, p_start_offset, p_end_offset);
+        break;
+
+        case READ_CMD_RANGE_TIME:
+        {
+            // to includes every record committed during its millisecond
+            uint64_t to_end_ns = (ULLONG_MAX == p_cmd->arg2) ? UINT64_MAX : unix_ms_to_monotonic_ns(p_cmd->arg2 + 1);
+            uint64_t to_ns = ((0 == to_end_ns) || (UINT64_MAX == to_end_ns)) ? to_end_ns : to_end_ns - 1;
+            b_found = record_index_time_range(p_index, unix_ms_to_monotonic_ns(p_cmd->arg1), to_ns, p_start_offset,
+                                              p_end_offset);
         }
+        break;
+
+        case READ_CMD_SEARCH:
+            // not a byte range, see serve_search_command
+        break;
     }
 
-    free(p_line); 
+    return b_found;
+}
+
+#if USE_AESD_CHAR_DEVICE != 1
+// @brief read bytes [start_offset, end_offset) of storage fd into p_wb_buf
+static bool read_storage_range(const int fd, const uint64_t start_offset, const uint64_t end_offset,
+                               struct writeback_buf_s * const p_wb_buf, size_t * const p_bytes_read)
+{
+    size_t len = end_offset - start_offset;
+    size_t bytes_read = 0;
+    bool b_status = reserve_writeback_buf(p_wb_buf, 0, len);
+
+    while (b_status && (bytes_read < len))
+    {
+        ssize_t read_size = pread(fd, p_wb_buf->p_buf + bytes_read, len - bytes_read, start_offset + bytes_read);
+        stats_add(STAT_STORAGE_READS, 1);
+        if (-1 == read_size)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            syslog(LOG_ERR, "pread failed with error %s", strerror(errno));
+            b_status = false;
+        }
+        else if (0 == read_size)
+        {
+            // the file was truncated under us
+            break;
+        }
+        else
+        {
+            bytes_read += read_size;
+        }
+    }
 
+    *p_bytes_read = bytes_read;
     return b_status;
 }
+#endif
+
+// @brief queue a writeback of only the records selected by read command p_cmd,
+// nothing is written back if no record matches
+static void serve_read_command(struct thread_args_s * const p_thread_args, struct read_cmd_s const * const p_cmd,
+                               struct writeback_buf_s * const p_wb_buf)
+{
+    int return_code;
+    bool b_found = false;
+    uint64_t start_offset = 0;
+    uint64_t end_offset = 0;
+    size_t bytes_read = 0;
+
+    stats_node_add(p_thread_args->numa_node, NODE_STAT_READ_COMMANDS, 1);
+
+    return_code = pthread_mutex_lock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex lock failed with error %s", strerror(return_code));
+    }
+
+#if USE_AESD_CHAR_DEVICE != 1
+    // the data file is append only, indexed records never change, so only the
+    // lookup needs the mutex and the read happens outside of it
+    struct snapshot_s snapshot = {0};
+    b_found = locate_records(&record_index, p_cmd, &start_offset, &end_offset);
+    bool b_have_snapshot = b_found && snapshot_cache_get(&snapshot_cache, &snapshot);
+
+    return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
+    }
+
+    // the response is scheduled like a commit, charged by its size
+    bool b_scheduled = b_found;
+    if (b_scheduled)
+    {
+        sched_acquire(&p_thread_args->sched_client, end_offset - start_offset);
+    }
+
+    if (b_have_snapshot)
+    {
+        outq_push_snapshot(&p_thread_args->outq, &snapshot, start_offset, end_offset - start_offset);
+    }
+    else if (b_found)
+    {
+        int fd = open(p_socket_data_file_pathname, O_RDONLY);
+        if (-1 == fd)
+        {
+            syslog(LOG_ERR, "open failed with error %s", strerror(errno));
+            b_found = false;
+        }
+        else
+        {
+            read_storage_range(fd, start_offset, end_offset, p_wb_buf, &bytes_read);
+            queue_writeback_buf(p_thread_args, p_wb_buf, 0, bytes_read);
+            close(fd);
+        }
+    }
+
+    if (b_scheduled)
+    {
+        sched_release(&p_thread_args->sched_client);
+    }
+#else
+    // aesdchar only keeps its last few entries and evicts them on its own, so
+    // there is no index to keep, read the device and index the copy instead
+    int fd = open(p_socket_data_file_pathname, O_RDONLY);
+    if (-1 == fd)
+    {
+        syslog(LOG_ERR, "open failed with error %s", strerror(errno));
+    }
+    else
+    {
+        b_found = read_storage(fd, 0, p_wb_buf, &bytes_read);
+        close(fd);
+    }
+
+    return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
+    }
+
+    if (b_found)
+    {
+        struct record_index_s device_index;
+        record_index_init(&device_index);
+        b_found = record_index_append(&device_index, p_wb_buf->p_buf, bytes_read, NULL) &&
+                  locate_records(&device_index, p_cmd, &start_offset, &end_offset);
+        record_index_destroy(&device_index);
+        if (b_found)
+        {
+            // the response is scheduled like a commit, charged by its size
+            sched_acquire(&p_thread_args->sched_client, end_offset - start_offset);
+            queue_writeback_buf(p_thread_args, p_wb_buf, start_offset, end_offset - start_offset);
+            sched_release(&p_thread_args->sched_client);
+        }
+    }
+#endif
+}
+
+// @brief queue a writeback of the records containing the pattern of search
+// command p_cmd, nothing is written back if no record matches. The log is
+// scanned outside of the mutex, from the snapshot in file mode
+static void serve_search_command(struct thread_args_s * const p_thread_args, struct read_cmd_s const * const p_cmd,
+                                 struct writeback_buf_s * const p_wb_buf)
+{
+    int return_code;
+    bool b_have_data = false;
+    char const * p_data = NULL;
+    size_t len = 0;
+    struct writeback_buf_s match_buf = {0};
+    struct search_result_s result;
+
+    stats_node_add(p_thread_args->numa_node, NODE_STAT_READ_COMMANDS, 1);
+
+    return_code = pthread_mutex_lock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex lock failed with error %s", strerror(return_code));
+    }
+
+#if USE_AESD_CHAR_DEVICE != 1
+    // only complete records are searched, the snapshot may end in a partial one
+    struct snapshot_s snapshot = {0};
+    uint64_t end_offset = record_index.end_offset;
+    bool b_have_snapshot = (end_offset > 0) && snapshot_cache_get(&snapshot_cache, &snapshot);
+
+    return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
+    }
+
+    if (b_have_snapshot)
+    {
+        p_data = snapshot.p_data;
+        len = end_offset;
+        b_have_data = true;
+    }
+    else if (end_offset > 0)
+    {
+        int fd = open(p_socket_data_file_pathname, O_RDONLY);
+        if (-1 == fd)
+        {
+            syslog(LOG_ERR, "open failed with error %s", strerror(errno));
+        }
+        else
+        {
+            b_have_data = read_storage_range(fd, 0, end_offset, p_wb_buf, &len);
+            p_data = p_wb_buf->p_buf;
+            close(fd);
+        }
+    }
+#else
+    int fd = open(p_socket_data_file_pathname, O_RDONLY);
+    if (-1 == fd)
+    {
+        syslog(LOG_ERR, "open failed with error %s", strerror(errno));
+    }
+    else
+    {
+        b_have_data = read_storage(fd, 0, p_wb_buf, &len);
+        p_data = p_wb_buf->p_buf;
+        close(fd);
+    }
+
+    return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
+    }
+
+    // drop an entry aesdchar holds without its newline yet
+    char const * p_last_newline = (len > 0) ? memrchr(p_data, '\n', len) : NULL;
+    len = (NULL != p_last_newline) ? (size_t)(p_last_newline + 1 - p_data) : 0;
+#endif
+
+    if (b_have_data && (len > 0))
+    {
+        if (!search_records(p_data, len, p_cmd->p_pattern, p_cmd->pattern_len, 0, &result))
+        {
+            syslog(LOG_ERR, "search ran out of memory, writeback misses records");
+        }
+
+        // gather the matching records into one writeback, scheduled like a
+        // commit and charged by its size
+        if ((result.bytes > 0) && reserve_writeback_buf(&match_buf, 0, result.bytes))
+        {
+            sched_acquire(&p_thread_args->sched_client, result.bytes);
+            size_t used = 0;
+            for (size_t idx = 0; idx < result.count; idx++)
+            {
+                size_t match_len = result.p_matches[idx].end - result.p_matches[idx].start;
+                memcpy(match_buf.p_buf + used, p_data + result.p_matches[idx].start, match_len);
+                used += match_len;
+            }
+            queue_writeback_buf(p_thread_args, &match_buf, 0, used);
+            sched_release(&p_thread_args->sched_client);
+        }
+        search_result_destroy(&result);
+    }
+
+#if USE_AESD_CHAR_DEVICE != 1
+    snapshot_put(&snapshot);
+#endif
+}
 
 // @brief to print help string for application
 static void print_help_str(void)
 {
-    printf("Usage: ./aesdsocket [-d]\n");
+    printf("Usage: ./aesdsocket [-d] [-p port] [-u unix_socket_path] [-f data_file_path] [-a cpu_list] [-w cpu_list]\n");
+    printf("                    [-l rate[,burst]] [-P address=class]... [-q high[,low[,timeout_ms]]]\n");
     printf("Use optional argument -d to daemonize process\n");
+    printf("Use optional argument -p to listen on port instead of %s, 0 picks an ephemeral port and prints it\n", PORT);
+    printf("Use optional argument -u to also accept connections on a unix domain socket at unix_socket_path\n");
+    printf("Use optional argument -f to store data at data_file_path instead of %s\n", SOCKET_DATA_FILE_PATHNAME);
+    printf("Use optional argument -a to pin the accepting thread to cpu_list, e.g. 0 or 0-1\n");
+    printf("Use optional argument -w to pin connection threads to cpu_list, e.g. 2-7,10-15, each thread\n");
+    printf("stays on the cpus of one numa node so its buffers are allocated on that node\n");
+    printf("Use optional argument -l to limit every client address to rate bytes of records and read\n");
+    printf("responses per second, with bursts of up to burst bytes (default rate)\n");
+    printf("Use optional argument -P to give client address the priority class high, normal (default) or low,\n");
+    printf("may be repeated. Commits are shared fairly by bytes between clients of the same class\n");
+    printf("Use optional argument -q to stop reading from a client with more than high bytes of writebacks\n");
+    printf("queued (default %lu) till it drained to low (default high/4), and to disconnect it when over\n",
+           OUTQ_DEFAULT_HIGH_WATERMARK);
+    printf("high it did not read anything for timeout_ms (default 0, never)\n");
+    printf("Send SIGUSR1 to log per numa node stats to syslog\n");
 }
 
-// @brief function to daemonize the process
-static bool daemonize_process(void)
-{
-    bool b_status = true;
+// @brief function to daemonize the process
+static bool daemonize_process(void)
+{
+    bool b_status = true;
+
+    pid_t pid = fork();
+    if (-1 == pid)
+    {
+        syslog(LOG_ERR, "fork failed with error: %s\n", strerror(errno));
+    }
+    else if (0 == pid)
+    {
+        // child process
+        if (-1 == setsid())
+        {
+            b_status = false;
+            syslog(LOG_ERR, "setsid failed with error: %s\n", strerror(errno));
+        }
+        else if (-1 == chdir("/"))
+        {
+            b_status = false;
+            syslog(LOG_ERR, "chdir failed with error: %s\n", strerror(errno));
+        }
+        else if (EOF == fcloseall())
+        {
+            b_status = false;
+            syslog(LOG_ERR, "fcloseall failed");
+        }
+
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (-1 == null_fd)
+        {
+            b_status = false;
+            syslog(LOG_ERR, "open failed with error: %s\n", strerror(errno));
+        }
+        else 
+        {
+            if ((-1 == dup2(null_fd, STDOUT_FILENO)) || 
+                (-1 == dup2(null_fd, STDERR_FILENO)) ||
+                (-1 == dup2(null_fd, STDIN_FILENO)))
+            {
+                b_status = false;
+                syslog(LOG_ERR, "dup2 failed to redirect");
+            }
+            if (-1 == close(null_fd))
+            {
+                b_status = false;
+                syslog(LOG_ERR, "close failed with error: %s\n", strerror(errno));
+            }
+        }
+
+    }
+    else
+    {
+        // parent process
+        exit(EXIT_SUCCESS);
+    }
+
+    return b_status;
+}
+
+// @brief fill p_str with a printable form of p_addr, tcp clients are
+// printed with inet_ntop, unix domain socket clients share one fixed name
+static bool client_address_to_str(struct sockaddr_storage const * const p_addr, char * const p_str, const socklen_t str_len)
+{
+    bool b_status = true;
+
+    if (AF_UNIX == p_addr->ss_family)
+    {
+        snprintf(p_str, str_len, "%s", UNIX_SOCKET_CLIENT_STR);
+    }
+    else if (AF_INET6 == p_addr->ss_family)
+    {
+        b_status = (NULL != inet_ntop(AF_INET6, &((struct sockaddr_in6 const *)p_addr)->sin6_addr, p_str, str_len));
+    }
+    else
+    {
+        b_status = (NULL != inet_ntop(AF_INET, &((struct sockaddr_in const *)p_addr)->sin_addr, p_str, str_len));
+    }
+
+    return b_status;
+}
+
+#if USE_AESD_CHAR_DEVICE != 1
+// @brief CLOCK_MONOTONIC time in ns, the commit time of records
+static uint64_t monotonic_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// @brief fill the client address of sidecar entry p_meta from p_addr, IPv4
+// addresses are mapped into IPv6, unix domain socket clients are left all zero
+static void client_address_to_meta(struct sockaddr_storage const * const p_addr, struct record_meta_s * const p_meta)
+{
+    memset(p_meta->client_addr, 0, sizeof(p_meta->client_addr));
+
+    if (AF_INET6 == p_addr->ss_family)
+    {
+        memcpy(p_meta->client_addr, &((struct sockaddr_in6 const *)p_addr)->sin6_addr, sizeof(p_meta->client_addr));
+    }
+    else if (AF_INET == p_addr->ss_family)
+    {
+        p_meta->client_addr[10] = 0xff;
+        p_meta->client_addr[11] = 0xff;
+        memcpy(&p_meta->client_addr[12], &((struct sockaddr_in const *)p_addr)->sin_addr, sizeof(struct in_addr));
+    }
+}
+#endif
+
+// @brief commit complete records (or handle the aesdchar command they contain)
+// and queue the storage contents for writeback to the client, once the scheduler
+// gives this connection its turn. In file mode the writeback is a snapshot of
+// the log, otherwise it is read from storage under the storage mutex
+static void commit_record(struct thread_args_s * const p_thread_args, char const * const p_record,
+                            const size_t record_len, struct writeback_buf_s * const p_wb_buf)
+{
+    FILE * ph_socket_data_file = NULL;
+    int return_code;
+    size_t bytes_read = 0;
+    const int h_recvfd = p_thread_args->h_recvfd;
+#if USE_AESD_CHAR_DEVICE != 1
+    struct snapshot_s snapshot = {0};
+    bool b_have_snapshot = false;
+#endif
+
+    AESD_PROBE2(lock_acquire, h_recvfd, record_len);
+    uint64_t lock_wait_start_ns = AESD_PROBE_TIMESTAMP(lock_acquired);
+
+    sched_acquire(&p_thread_args->sched_client, record_len);
+
+    // acquire mutex
+    return_code = pthread_mutex_lock(p_thread_args->p_mutex);
+    if (return_code != 0)
+    {
+        syslog(LOG_ERR, "mutex lock failed with error %s", strerror(return_code));
+    }
+    AESD_PROBE2(lock_acquired, h_recvfd, AESD_PROBE_ELAPSED(lock_wait_start_ns));
+    uint64_t lock_hold_start_ns = AESD_PROBE_TIMESTAMP(lock_release);
+
+    // open socket data file in append mode 
+    if (!open_socket_data_file(p_socket_data_file_pathname, &ph_socket_data_file))
+    {
+        syslog(LOG_ERR, "could not create/open %s", p_socket_data_file_pathname);
+    }
+    else
+    {
+        bool b_contains_aesd_char_cmd = (memmem(p_record, record_len, AESDCHAR_IOCSEEKTO_CMD_STR, strlen(AESDCHAR_IOCSEEKTO_CMD_STR))) ? true : false;
+
+        if (!b_contains_aesd_char_cmd)
+        {
+            // write to file, if received string does not contain aesd char command
+            uint64_t append_start_ns = AESD_PROBE_TIMESTAMP(store_append);
+            size_t bytes_written = fwrite(p_record, 1, record_len, ph_socket_data_file);
+            AESD_PROBE3(store_append, h_recvfd, bytes_written, AESD_PROBE_ELAPSED(append_start_ns));
+
+            if (bytes_written != record_len)
+            {
+                syslog(LOG_ERR, "fwrite did not complete write to socket data file, error %s", strerror(errno));
+            }
+#if USE_AESD_CHAR_DEVICE != 1
+            p_thread_args->record_meta.commit_ns = monotonic_now_ns();
+            if (!record_index_append(&record_index, p_record, bytes_written, &p_thread_args->record_meta))
+            {
+                syslog(LOG_ERR, "could not grow record index");
+            }
+            snapshot_cache_append(&snapshot_cache, p_record, bytes_written);
+#endif
+            stats_node_add(p_thread_args->numa_node, NODE_STAT_RECORDS_COMMITTED, 1);
+        }
+        else
+        {
+            struct aesd_seekto seekto;
+
+            // read write_cmd and offset from string
+            sscanf(p_record, AESDCHAR_IOCSEEKTO_FMT_STR, &seekto.write_cmd, &seekto.write_cmd_offset);
+
+            int fd = fileno(ph_socket_data_file);
+            if (-1 == fd)
+            {
+                syslog(LOG_ERR, "fileno failed with error %s", strerror(errno));
+            }
+
+            // send cmd to aesdchar driver
+            int result = ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
+            if (result < 0)
+            {
+                syslog(LOG_ERR, "ioctl failed with error %s", strerror(errno));
+            }
+        }
+
+#if USE_AESD_CHAR_DEVICE != 1
+        // connections committing at the same time share the current version of
+        // the log instead of each reading it from storage
+        b_have_snapshot = snapshot_cache_get(&snapshot_cache, &snapshot);
+        if (!b_have_snapshot)
+#endif
+        {
+            // read socketdatafile contents to write back over socket connection
+            AESD_PROBE1(writeback_start, h_recvfd);
+            uint64_t writeback_start_ns = AESD_PROBE_TIMESTAMP(writeback_end);
+            if (!read_writeback(ph_socket_data_file, p_wb_buf, &bytes_read))
+            {
+                syslog(LOG_ERR, "writeback failed!");
+            }
+            AESD_PROBE3(writeback_end, h_recvfd, bytes_read, AESD_PROBE_ELAPSED(writeback_start_ns));
+        }
+
+        // close socket data file, this also flushes the record for readers of the file
+        fclose(ph_socket_data_file);
+    }
 
-    pid_t pid = fork();
-    if (-1 == pid)
+    // release mutex
+    return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
+    if (return_code != 0)
     {
-        syslog(LOG_ERR, "fork failed with error: %s\n", strerror(errno));
+        syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
     }
-    else if (0 == pid)
+
+    sched_release(&p_thread_args->sched_client);
+    AESD_PROBE2(lock_release, h_recvfd, AESD_PROBE_ELAPSED(lock_hold_start_ns));
+
+#if USE_AESD_CHAR_DEVICE != 1
+    if (b_have_snapshot)
     {
-        // child process
-        if (-1 == setsid())
-        {
-            b_status = false;
-            syslog(LOG_ERR, "setsid failed with error: %s\n", strerror(errno));
-        }
-        else if (-1 == chdir("/"))
-        {
-            b_status = false;
-            syslog(LOG_ERR, "chdir failed with error: %s\n", strerror(errno));
-        }
-        else if (EOF == fcloseall())
+        AESD_PROBE1(writeback_start, h_recvfd);
+        AESD_PROBE3(writeback_end, h_recvfd, snapshot.len, 0);
+        stats_add(STAT_SNAPSHOT_WRITEBACKS, 1);
+        if (!outq_push_snapshot(&p_thread_args->outq, &snapshot, 0, snapshot.len))
         {
-            b_status = false;
-            syslog(LOG_ERR, "fcloseall failed");
+            syslog(LOG_ERR, "could not queue writeback of %zu bytes", snapshot.len);
         }
+    }
+    else
+#endif
+    {
+        queue_writeback_buf(p_thread_args, p_wb_buf, 0, bytes_read);
+    }
+}
 
-        int null_fd = open("/dev/null", O_WRONLY);
-        if (-1 == null_fd)
+// @brief process the complete lines received in p_record_buf, starting the scan
+// for a newline at *p_scanned. Read commands get a writeback of their own, the
+// other lines are written to file together with one writeback for the batch,
+// like the lines of one recv. Stops early once the output queue grows over the
+// high watermark, the remaining lines are processed when the client caught up
+static void process_records(struct thread_args_s * const p_thread_args, char * const p_record_buf,
+                            size_t * const p_record_len, size_t * const p_scanned,
+                            struct writeback_buf_s * const p_wb_buf, const uint64_t record_start_ns)
+{
+    size_t record_len = *p_record_len;
+    size_t line_start = 0;
+    // start of the lines not committed yet, line_start if there are none
+    size_t batch_start = 0;
+    char * p_scan = p_record_buf + *p_scanned;
+    char * p_newline;
+
+    while (p_thread_args->outq.queued_bytes <= outq_config.high_watermark)
+    {
+        p_newline = memchr(p_scan, '\n', p_record_buf + record_len - p_scan);
+        if (NULL == p_newline)
         {
-            b_status = false;
-            syslog(LOG_ERR, "open failed with error: %s\n", strerror(errno));
+            // the rest is a partial record, it is not scanned again
+            p_scan = p_record_buf + record_len;
+            break;
         }
-        else 
+
+        size_t line_end = p_newline - p_record_buf + 1;
+        size_t line_len = line_end - line_start;
+        char next_char = p_record_buf[line_end];
+        p_record_buf[line_end] = '\0';
+        AESD_PROBE3(record_complete, p_thread_args->h_recvfd, line_len, AESD_PROBE_ELAPSED(record_start_ns));
+
+        struct read_cmd_s read_cmd;
+        bool b_is_read_cmd = parse_read_cmd(p_record_buf + line_start, &read_cmd);
+        p_record_buf[line_end] = next_char;
+        if (b_is_read_cmd)
         {
-            if ((-1 == dup2(null_fd, STDOUT_FILENO)) || 
-                (-1 == dup2(null_fd, STDERR_FILENO)) ||
-                (-1 == dup2(null_fd, STDIN_FILENO)))
+            // lines before the command are committed first, the command sees them
+            if (batch_start < line_start)
             {
-                b_status = false;
-                syslog(LOG_ERR, "dup2 failed to redirect");
+                commit_record(p_thread_args, p_record_buf + batch_start, line_start - batch_start, p_wb_buf);
             }
-            if (-1 == close(null_fd))
+            if (READ_CMD_SEARCH == read_cmd.type)
             {
-                b_status = false;
-                syslog(LOG_ERR, "close failed with error: %s\n", strerror(errno));
+                serve_search_command(p_thread_args, &read_cmd, p_wb_buf);
+            }
+            else
+            {
+                serve_read_command(p_thread_args, &read_cmd, p_wb_buf);
             }
+            batch_start = line_end;
         }
-
+        line_start = line_end;
+        p_scan = p_newline + 1;
     }
-    else
+
+    if (batch_start < line_start)
     {
-        // parent process
-        exit(EXIT_SUCCESS);
+        commit_record(p_thread_args, p_record_buf + batch_start, line_start - batch_start, p_wb_buf);
     }
 
-    return b_status;
+    // keep what was not processed, lines held back and a partial record
+    // received after the last newline, for the next round
+    if (line_start > 0)
+    {
+        record_len -= line_start;
+        memmove(p_record_buf, p_record_buf + line_start, record_len + 1);
+        p_scan -= line_start;
+    }
+    *p_record_len = record_len;
+    *p_scanned = p_scan - p_record_buf;
 }
 
-// @brief function for service thread, to handle read and writeback on a new connection
+// @brief function for service thread, to handle read and writeback on a new connection.
+// Writebacks are queued per connection and sent as the client reads them, the
+// client is not read from while its queue is over the high watermark
 static void * service_thread(void * p_arg)
 {
-    FILE * ph_socket_data_file = NULL;
-    char p_buffer[RECV_BUF_LEN] = {0};
-    char p_ip_addr_buffer[INET_ADDRSTRLEN];
-    int malloc_buf_size = 0;
-    int byte_string_len = 0;
-    char * p_malloc_buf = NULL;
+    char p_ip_addr_buffer[CLIENT_ADDR_STR_LEN];
+    // bytes received are accumulated in p_record_buf till a newline completes
+    // a record, the buffer comes from buf_pool and is reused for every record
+    char * p_record_buf = NULL;
+    size_t record_buf_size = 0;
+    size_t record_len = 0;
+    // bytes of p_record_buf already scanned for a newline
+    size_t scanned = 0;
     char * p_tmp = NULL;
-    int return_code; 
+    struct writeback_buf_s wb_buf = {0};
+    size_t conn_bytes_received = 0;
+    size_t conn_bytes_sent = 0;
+    uint64_t record_start_ns = 0;
+    // set once the client closed its side, queued writebacks are still sent
+    bool b_recv_done = false;
 
     struct thread_args_s * p_thread_args = (struct thread_args_s *)p_arg;
+    const int h_recvfd = p_thread_args->h_recvfd;
+    uint64_t conn_start_ns = AESD_PROBE_TIMESTAMP(close);
+
+    // SIGUSR1 should wake up the acceptor to log stats, not interrupt a poll here
+    sigset_t sigusr1_set;
+    sigemptyset(&sigusr1_set);
+    sigaddset(&sigusr1_set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigusr1_set, NULL);
+
+    // the thread was started on the cpus of one node, when pinned, so the
+    // buffers allocated below are first touched on, and placed on, that node
+    p_thread_args->numa_node = placement_current_node();
+    stats_node_add(p_thread_args->numa_node, NODE_STAT_CONNECTIONS, 1);
+    outq_init(&p_thread_args->outq);
+#if USE_AESD_CHAR_DEVICE != 1
+    client_address_to_meta(&p_thread_args->remote_client_address, &p_thread_args->record_meta);
+#endif
 
     // log message to syslog "Accecpted connection from xxxx"
-    if (NULL == inet_ntop(AF_INET, &p_thread_args->remote_client_address.sin_addr, p_ip_addr_buffer, sizeof(p_ip_addr_buffer)))
+    if (!client_address_to_str(&p_thread_args->remote_client_address, p_ip_addr_buffer, sizeof(p_ip_addr_buffer)))
     {
         syslog(LOG_ERR, "inet_ntop failed with error: %s\n", strerror(errno));
+        snprintf(p_ip_addr_buffer, sizeof(p_ip_addr_buffer), "unknown");
     }
     else
     {
         // log accept connection message
         syslog(LOG_DEBUG, "Accepted connection from %s\n", p_ip_addr_buffer);
+
+        // priority class and rate limit are keyed by the client address
+        sched_client_init(&p_thread_args->sched_client, p_ip_addr_buffer);
+
         while (true)
         {
-            int bytes_recv = recv(p_thread_args->h_recvfd, p_buffer, RECV_BUF_LEN - 1, 0);
-            if (-1 == bytes_recv)
+            struct outq_s * p_outq = &p_thread_args->outq;
+            bool b_paused_now;
+            int timeout_ms;
+
+            if (!p_outq->b_paused && (scanned < record_len))
             {
-                syslog(LOG_ERR, "recv failed with error %s", strerror(errno));
-                break;
+                process_records(p_thread_args, p_record_buf, &record_len, &scanned, &wb_buf, record_start_ns);
             }
-            else if (0 == bytes_recv)
+
+            size_t bytes_sent = 0;
+            bool b_send_ok = outq_flush(p_outq, h_recvfd, &bytes_sent);
+            conn_bytes_sent += bytes_sent;
+            stats_node_add(p_thread_args->numa_node, NODE_STAT_BYTES_WRITTEN_BACK, bytes_sent);
+            if (!b_send_ok)
             {
-                // connection closed
                 break;
             }
-            p_buffer[bytes_recv] = '\0';
 
-            // check if p_buffer contain \n and set a flag
-            bool b_contains_newline = (strchr(p_buffer, '\n') != NULL) ? true : false;
-            bool b_is_first_malloc = (0 == malloc_buf_size) ? true : false;
-            byte_string_len += bytes_recv;
-            malloc_buf_size += bytes_recv + 1; // +1 for null terminator
-            
-            // allocate memory
-            p_tmp = realloc(p_malloc_buf, malloc_buf_size);
-            if (p_tmp != NULL)
+            bool b_paused = outq_update_backpressure(p_outq, &outq_config, &b_paused_now);
+            if (b_paused_now)
             {
-                p_malloc_buf = p_tmp;
+                stats_node_add(p_thread_args->numa_node, NODE_STAT_OUTQ_OVERFLOWS, 1);
             }
-            else
+
+            // done once the client closed its side and every record it sent
+            // was processed and written back
+            if (b_recv_done && (0 == p_outq->queued_bytes) && (scanned == record_len))
             {
                 break;
             }
 
-            if (b_is_first_malloc)
+            if (outq_is_slow_consumer(p_outq, &outq_config, &timeout_ms))
             {
-                // if first malloc, strcpy
-                strcpy(p_malloc_buf,  p_buffer);
+                syslog(LOG_INFO, "disconnecting slow consumer %s with %zu bytes queued", p_ip_addr_buffer,
+                       p_outq->queued_bytes);
+                stats_node_add(p_thread_args->numa_node, NODE_STAT_SLOW_CONSUMER_DISCONNECTS, 1);
+                break;
             }
-            else
+
+            struct pollfd poll_fd = {.fd = h_recvfd, .events = 0};
+            if (!b_paused && !b_recv_done)
             {
-                // append to existing string in malloc buf
-                strcat(p_malloc_buf, p_buffer);
+                poll_fd.events |= POLLIN;
             }
-
-            // if contains newline, write to file, and perform writeback
-            if (b_contains_newline)
+            if (p_outq->queued_bytes > 0)
             {
-                // acquire mutex
-                return_code = pthread_mutex_lock(p_thread_args->p_mutex);
-                if (return_code != 0)
-                {
-                    syslog(LOG_ERR, "mutex lock failed with error %s", strerror(return_code));
-                }
-
-                // open socket data file in append mode 
-                if (!open_socket_data_file(SOCKET_DATA_FILE_PATHNAME, &ph_socket_data_file))
-                {
-                    syslog(LOG_ERR, "could not create/open %s", SOCKET_DATA_FILE_PATHNAME);
-                }
-
-
-                bool b_contains_aesd_char_cmd = (strstr(p_malloc_buf, AESDCHAR_IOCSEEKTO_CMD_STR)) ? true : false;
-                
-                if (!b_contains_aesd_char_cmd)
-                {
-                    // write to file, if received string does not contain aesd char command
-                    int bytes_written = fprintf(ph_socket_data_file, "%s", p_malloc_buf);
-
-                    if (bytes_written != byte_string_len)
-                    {
-                        syslog(LOG_ERR, "fprintf did not complete write to socket data file");
-                    }
-                    else if (bytes_written < 0)
-                    {
-                        syslog(LOG_ERR, "fprintf failed with error %s", strerror(errno));
-                    }
-                }
-                else
-                {
-                    struct aesd_seekto seekto;
-
-                    // read write_cmd and offset from string
-                    sscanf(p_malloc_buf, AESDCHAR_IOCSEEKTO_FMT_STR, &seekto.write_cmd, &seekto.write_cmd_offset);
-
-                    int fd = fileno(ph_socket_data_file);
-                    if (-1 == fd)
-                    {
-                        syslog(LOG_ERR, "fileno failed with error %s", strerror(errno));
-                    }
-
-                    // send cmd to aesdchar driver
-                    int result = ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
-                    if (result < 0)
-                    {
-                        syslog(LOG_ERR, "ioctl failed with error %s", strerror(errno));
-                    }
-                }
+                poll_fd.events |= POLLOUT;
+            }
+            if (0 == poll_fd.events)
+            {
+                // held back lines are left to process, nothing to wait for
+                continue;
+            }
 
-                // send socketdatafile contents back over socket connection
-                if (!writeback(ph_socket_data_file, p_thread_args->h_recvfd))
+            int poll_ret = poll(&poll_fd, 1, timeout_ms);
+            if (-1 == poll_ret)
+            {
+                if (EINTR == errno)
                 {
-                    syslog(LOG_ERR, "writeback failed!");
+                    continue;
                 }
+                syslog(LOG_ERR, "poll failed with error %s", strerror(errno));
+                break;
+            }
+            if (poll_fd.revents & POLLERR)
+            {
+                break;
+            }
+            if (!(poll_fd.revents & (POLLIN | POLLHUP)) || b_recv_done || b_paused)
+            {
+                // writable, or the slow consumer timeout expired
+                continue;
+            }
 
-                // close socket data file
-                fclose(ph_socket_data_file);
+            // make room to receive straight into the record buffer, +1 for null terminator
+            p_tmp = buf_pool_grow(p_record_buf, record_len, &record_buf_size, record_len + RECV_BUF_LEN + 1);
+            if (NULL == p_tmp)
+            {
+                syslog(LOG_ERR, "could not grow record buffer");
+                break;
+            }
+            p_record_buf = p_tmp;
 
-                // release mutex
-                return_code = pthread_mutex_unlock(p_thread_args->p_mutex);
-                if (return_code != 0)
+            ssize_t bytes_recv = recv(h_recvfd, p_record_buf + record_len, RECV_BUF_LEN, MSG_DONTWAIT);
+            if (-1 == bytes_recv)
+            {
+                if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
                 {
-                    syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
+                    continue;
                 }
+                syslog(LOG_ERR, "recv failed with error %s", strerror(errno));
+                break;
+            }
+            else if (0 == bytes_recv)
+            {
+                // connection closed, finish the records already received
+                b_recv_done = true;
+                continue;
             }
+            stats_node_add(p_thread_args->numa_node, NODE_STAT_BYTES_RECEIVED, bytes_recv);
+            AESD_PROBE2(recv, h_recvfd, bytes_recv);
+            conn_bytes_received += bytes_recv;
+            if (0 == record_len)
+            {
+                record_start_ns = AESD_PROBE_TIMESTAMP(record_complete);
+            }
+            record_len += bytes_recv;
+            p_record_buf[record_len] = '\0';
         }
+
+        sched_client_destroy(&p_thread_args->sched_client);
     }
 
-    // free malloc'd data
-    free(p_malloc_buf); 
+    // return buffers to the pool, and hand this thread's cached blocks to
+    // the next connection
+    outq_destroy(&p_thread_args->outq);
+    buf_pool_free(p_record_buf, record_buf_size);
+    buf_pool_free(wb_buf.p_buf, wb_buf.buf_size);
+    buf_pool_thread_flush();
+
+    AESD_PROBE4(close, h_recvfd, conn_bytes_received, conn_bytes_sent, AESD_PROBE_ELAPSED(conn_start_ns));
+    if (-1 == close(h_recvfd))
+    {
+        syslog(LOG_ERR, "close failed with error %s", strerror(errno));
+    }
 
     // logs closed connection message
     syslog(LOG_DEBUG, "Closed connection from %s\n", p_ip_addr_buffer);
@@ -469,22 +1410,33 @@ static void timer_callback(union sigval)
         syslog(LOG_ERR, "mutex lock failed with error %s", strerror(return_code));
     }
 
-    // open socketdata file in append mode
-    if (!open_socket_data_file(SOCKET_DATA_FILE_PATHNAME, &ph_socket_data_file))
+    // open socketdata file in append mode, unless main is already shutting down
+    if (b_timer_stopped)
     {
-        syslog(LOG_ERR, "could not create/open %s", SOCKET_DATA_FILE_PATHNAME);
+        syslog(LOG_DEBUG, "timer stopped, timestamp dropped");
     }
-
-    // write timestamp to file
-    int bytes_written = fprintf(ph_socket_data_file, "timestamp:%s\n", timestamp);
-
-    if (bytes_written < 0)
+    else if (!open_socket_data_file(p_socket_data_file_pathname, &ph_socket_data_file))
     {
-        syslog(LOG_ERR, "fprintf failed with error %s", strerror(errno));
+        syslog(LOG_ERR, "could not create/open %s", p_socket_data_file_pathname);
     }
+    else
+    {
+        // write timestamp to file, and add it to the record index
+        char timestamp_record[MAX_TIMESTAMP_LEN + sizeof("timestamp:\n")];
+        int record_len = snprintf(timestamp_record, sizeof(timestamp_record), "timestamp:%s\n", timestamp);
+        size_t bytes_written = fwrite(timestamp_record, 1, record_len, ph_socket_data_file);
+
+        if (bytes_written != (size_t)record_len)
+        {
+            syslog(LOG_ERR, "fwrite failed with error %s", strerror(errno));
+        }
+        struct record_meta_s timestamp_meta = {.commit_ns = monotonic_now_ns()};
+        record_index_append(&record_index, timestamp_record, bytes_written, &timestamp_meta);
+        snapshot_cache_append(&snapshot_cache, timestamp_record, bytes_written);
 
-    // close file
-    fclose(ph_socket_data_file);
+        // close file
+        fclose(ph_socket_data_file);
+    }
 
     // release mutex
     return_code = pthread_mutex_unlock(&mutex);
@@ -493,26 +1445,73 @@ static void timer_callback(union sigval)
         syslog(LOG_ERR, "mutex unlock failed with error %s", strerror(return_code));
     }
 }
-#endif
 
-int main(const int argc, char ** const p_argv)
+// @brief index and cache the records of a data file left behind by an earlier run
+static bool load_socket_data_file(char const * const p_pathname)
 {
-    int return_code = 0;
+    bool b_status = true;
+    char buf[INDEX_LOAD_BUF_LEN];
 
-    // check if more than the supported number of arguements have 
-    // been provided
-    if (argc > 2)
+    record_index_init(&record_index);
+    if (!snapshot_cache_init(&snapshot_cache))
     {
-        syslog(LOG_ERR, "Invalid number of arguement");
-        print_help_str();
-        exit(EXIT_APP_FAILURE);
+        syslog(LOG_ERR, "could not allocate snapshot cache, writebacks read storage");
+    }
+
+    int fd = open(p_pathname, O_RDONLY);
+    if (-1 == fd)
+    {
+        // nothing to index if no data file exists yet
+        return ENOENT == errno;
     }
 
+    while (b_status)
+    {
+        ssize_t read_size = read(fd, buf, sizeof(buf));
+        if (-1 == read_size)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            syslog(LOG_ERR, "read failed with error %s", strerror(errno));
+            b_status = false;
+        }
+        else if (0 == read_size)
+        {
+            break;
+        }
+        else
+        {
+            b_status = record_index_append(&record_index, buf, read_size, NULL);
+            snapshot_cache_append(&snapshot_cache, buf, read_size);
+        }
+    }
+
+    close(fd);
+    return b_status;
+}
+#endif
+
+int main(const int argc, char ** const p_argv)
+{
+    int return_code = 0;
+
     int opt_char;
     bool b_daemonize = false;
-
-    // check if -d flag provided to daemonsize process
-    while ((opt_char = getopt(argc, p_argv, "d")) != -1)
+    char const * p_unix_socket_path = NULL;
+    char const * p_port = PORT;
+    char const * p_acceptor_cpu_list = NULL;
+    char const * p_worker_cpu_list = NULL;
+    struct placement_s placement;
+    struct sched_config_s sched_config;
+
+    sched_config_init(&sched_config);
+    outq_config_init(&outq_config);
+
+    // check if -d flag provided to daemonsize process, and if -u provided
+    // to listen on a unix domain socket next to the tcp port
+    while ((opt_char = getopt(argc, p_argv, "dp:u:f:a:w:l:P:q:")) != -1)
     {
         switch (opt_char)
         {
@@ -520,6 +1519,53 @@ int main(const int argc, char ** const p_argv)
                 b_daemonize = true;
             break;
 
+            case 'p':
+                p_port = optarg;
+            break;
+
+            case 'u':
+                p_unix_socket_path = optarg;
+            break;
+
+            case 'f':
+                p_socket_data_file_pathname = optarg;
+            break;
+
+            case 'a':
+                p_acceptor_cpu_list = optarg;
+            break;
+
+            case 'w':
+                p_worker_cpu_list = optarg;
+            break;
+
+            case 'l':
+                if (!sched_config_parse_rate(&sched_config, optarg))
+                {
+                    syslog(LOG_ERR, "Invalid rate limit %s!", optarg);
+                    print_help_str();
+                    exit(EXIT_APP_FAILURE);
+                }
+            break;
+
+            case 'P':
+                if (!sched_config_add_priority_rule(&sched_config, optarg))
+                {
+                    syslog(LOG_ERR, "Invalid priority rule %s!", optarg);
+                    print_help_str();
+                    exit(EXIT_APP_FAILURE);
+                }
+            break;
+
+            case 'q':
+                if (!outq_config_parse(&outq_config, optarg))
+                {
+                    syslog(LOG_ERR, "Invalid output queue policy %s!", optarg);
+                    print_help_str();
+                    exit(EXIT_APP_FAILURE);
+                }
+            break;
+
             default:
                 syslog(LOG_ERR, "Invalid option %c!", opt_char);
                 print_help_str();
@@ -528,13 +1574,42 @@ int main(const int argc, char ** const p_argv)
         }
     }
 
+    if (optind < argc)
+    {
+        syslog(LOG_ERR, "Invalid number of arguement");
+        print_help_str();
+        exit(EXIT_APP_FAILURE);
+    }
+
+    if (!placement_init(&placement, p_acceptor_cpu_list, p_worker_cpu_list))
+    {
+        print_help_str();
+        exit(EXIT_APP_FAILURE);
+    }
+
+    sched_init(&sched_config);
+
+#if USE_AESD_CHAR_DEVICE != 1
+    if (!load_socket_data_file(p_socket_data_file_pathname))
+    {
+        syslog(LOG_ERR, "could not index %s", p_socket_data_file_pathname);
+    }
+#endif
+
     int h_sockfd = 0;
-    if (!bind_to_address(NULL, PORT, &h_sockfd))
+    if (!bind_to_address(NULL, p_port, &h_sockfd))
     {
         syslog(LOG_ERR, "could not bind address provided!");
         exit(EXIT_SOCKET_FAILURE);
     }
 
+    int h_unix_sockfd = -1;
+    if ((NULL != p_unix_socket_path) && !bind_to_unix_path(p_unix_socket_path, &h_unix_sockfd))
+    {
+        syslog(LOG_ERR, "could not bind unix socket path provided!");
+        exit(EXIT_SOCKET_FAILURE);
+    }
+
     if (b_daemonize)
     {
         if (!daemonize_process())
@@ -548,6 +1623,11 @@ int main(const int argc, char ** const p_argv)
         }
     }
 
+    if (!placement_pin_acceptor(&placement))
+    {
+        syslog(LOG_ERR, "could not pin accepting thread");
+    }
+
 #if USE_AESD_CHAR_DEVICE != 1
     // note: timer must be created in child process, because 
     // child does not inherit timer from parent
@@ -587,29 +1667,85 @@ int main(const int argc, char ** const p_argv)
         exit(EXIT_SOCKET_FAILURE);
     }
 
+    if ((-1 != h_unix_sockfd) && (-1 == listen(h_unix_sockfd, BACKLOG)))
+    {
+        syslog(LOG_ERR, "listen on unix socket failed with error: %s\n", strerror(errno));
+        exit(EXIT_SOCKET_FAILURE);
+    }
+
+    // printed once every listener accepts connections, scripts wait for it
+    if (0 == strcmp(p_port, "0"))
+    {
+        print_bound_port(h_sockfd);
+    }
+
+    // both listeners feed the same service_thread, the unix socket is only
+    // polled when it was requested
+    struct pollfd listen_fds[] = {
+        {.fd=h_sockfd, .events=POLLIN},
+        {.fd=h_unix_sockfd, .events=POLLIN},
+    };
+    nfds_t num_listen_fds = (-1 != h_unix_sockfd) ? 2 : 1;
+
     // initialize linked list
     struct slist_head_s slist_head;
     SLIST_INIT(&slist_head);
 
     while (b_accept_connections)
     {
-        struct sockaddr_in remote_client_addr;
-        socklen_t remote_client_addr_size = sizeof(remote_client_addr);
-
-        int h_recvfd = accept(h_sockfd, (struct sockaddr *)&remote_client_addr, &remote_client_addr_size); 
-        if (-1 == h_recvfd)
+        if (-1 == poll(listen_fds, num_listen_fds, -1))
         {
-            syslog(LOG_ERR, "accept failed with error: %s\n", strerror(errno));
+            if (EINTR == errno)
+            {
+                // signal received, b_accept_connections tells if we should exit
+                if (b_log_stats)
+                {
+                    b_log_stats = false;
+                    stats_log();
+                }
+                continue;
+            }
+            syslog(LOG_ERR, "poll failed with error: %s\n", strerror(errno));
             break;
         }
-        else
+
+        bool b_accept_failed = false;
+        for (nfds_t idx = 0; idx < num_listen_fds; idx++)
         {
+            if (0 == (listen_fds[idx].revents & POLLIN))
+            {
+                continue;
+            }
+
+            struct sockaddr_storage remote_client_addr;
+            socklen_t remote_client_addr_size = sizeof(remote_client_addr);
+
+            int h_recvfd = accept(listen_fds[idx].fd, (struct sockaddr *)&remote_client_addr, &remote_client_addr_size); 
+            if (-1 == h_recvfd)
+            {
+                syslog(LOG_ERR, "accept failed with error: %s\n", strerror(errno));
+                b_accept_failed = true;
+                break;
+            }
+            AESD_PROBE1(accept, h_recvfd);
+
+            // a writeback goes out in one send, nagle would only hold back its last
+            // segment till the client acks, which pipelining clients do late
+            int nodelay = 1;
+            if ((AF_UNIX != remote_client_addr.ss_family) &&
+                (-1 == setsockopt(h_recvfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay))))
+            {
+                syslog(LOG_ERR, "setsockopt TCP_NODELAY failed with error %s", strerror(errno));
+            }
+
             // create thread and save thread args structure on linked list
             struct slist_entry_s * p_slist_entry;
-            p_slist_entry = malloc(sizeof(struct slist_entry_s));
+            size_t slist_entry_size;
+            p_slist_entry = buf_pool_alloc(sizeof(struct slist_entry_s), &slist_entry_size);
             if (NULL == p_slist_entry)
             {
                 syslog(LOG_ERR, "malloc failed, could not create new thread, exiting!");
+                close(h_recvfd);
             }
             else 
             {
@@ -617,11 +1753,17 @@ int main(const int argc, char ** const p_argv)
                 p_slist_entry->thread_args.p_mutex = &mutex;
                 p_slist_entry->thread_args.remote_client_address = remote_client_addr;
                 p_slist_entry->thread_args.b_is_thread_complete = false;
-                return_code = pthread_create(&p_slist_entry->thread_args.tid, NULL, service_thread, (void *)p_slist_entry);
+
+                pthread_attr_t thread_attr;
+                pthread_attr_init(&thread_attr);
+                placement_set_worker_attr(&placement, &thread_attr);
+                return_code = pthread_create(&p_slist_entry->thread_args.tid, &thread_attr, service_thread, (void *)p_slist_entry);
+                pthread_attr_destroy(&thread_attr);
                 if (return_code != 0)
                 {
                     syslog(LOG_ERR, "thread create failed with error %s", strerror(return_code));
-                    free(p_slist_entry);
+                    close(h_recvfd);
+                    buf_pool_free(p_slist_entry, sizeof(struct slist_entry_s));
                 }
                 else
                 {
@@ -630,11 +1772,18 @@ int main(const int argc, char ** const p_argv)
             }
         }
 
+        if (b_accept_failed)
+        {
+            break;
+        }
+
         // check for closed threads to pthread join them, and free 
         // malloc'd memory
         struct slist_entry_s * p_slist_entry = SLIST_FIRST(&slist_head);
         while (p_slist_entry)
         {
+            // fetch next before p_slist_entry is freed
+            struct slist_entry_s * p_next_slist_entry = SLIST_NEXT(p_slist_entry, slist_entries);
             if (p_slist_entry->thread_args.b_is_thread_complete)
             {
                 return_code = pthread_join(p_slist_entry->thread_args.tid, NULL);
@@ -643,9 +1792,9 @@ int main(const int argc, char ** const p_argv)
                     syslog(LOG_ERR, "pthread join failed with error %s", strerror(return_code));
                 }
                 SLIST_REMOVE(&slist_head, p_slist_entry, slist_entry_s, slist_entries);
-                free(p_slist_entry);
+                buf_pool_free(p_slist_entry, sizeof(struct slist_entry_s));
             }
-            p_slist_entry = SLIST_NEXT(p_slist_entry, slist_entries);
+            p_slist_entry = p_next_slist_entry;
         }
     }
 
@@ -662,24 +1811,39 @@ int main(const int argc, char ** const p_argv)
             syslog(LOG_ERR, "pthread join failed with error %s", strerror(return_code));
         }
         SLIST_REMOVE_HEAD(&slist_head, slist_entries);
-        free(p_slist_entry);
+        buf_pool_free(p_slist_entry, sizeof(struct slist_entry_s));
     }
 
 #if USE_AESD_CHAR_DEVICE != 1
-    if (-1 == remove(SOCKET_DATA_FILE_PATHNAME))
+    // stop the timestamp timer first, its callback appends to the index and cache,
+    // a callback thread already started sees b_timer_stopped once it gets the mutex
+    if (-1 == timer_delete(timer))
+    {
+        syslog(LOG_ERR, "timer_delete failed with error %s", strerror(errno));
+    }
+    pthread_mutex_lock(&mutex);
+    b_timer_stopped = true;
+    pthread_mutex_unlock(&mutex);
+    if (-1 == remove(p_socket_data_file_pathname))
     {
         syslog(LOG_ERR, "remove failed with error %s", strerror(errno));
     }
+    record_index_destroy(&record_index);
+    snapshot_cache_destroy(&snapshot_cache);
 #endif
+    stats_log();
+
     // h_recvfd closed when recv is complete in respective thread
     close(h_sockfd);
 
-#if USE_AESD_CHAR_DEVICE != 1
-    if (-1 == timer_delete(timer))
+    if (-1 != h_unix_sockfd)
     {
-        syslog(LOG_ERR, "timer_delete failed with error %s", strerror(errno));
+        close(h_unix_sockfd);
+        if (-1 == unlink(p_unix_socket_path))
+        {
+            syslog(LOG_ERR, "unlink failed with error %s", strerror(errno));
+        }
     }
-#endif
 
     if (b_accept_connections == false)
     {
@@ -0,0 +1,244 @@
+/*
+ * @file buf_pool.c
+ * @author krish shah
+ * @brief size class buffer pool. Each thread keeps a small cache of free blocks
+ * per size class that it can use without locking. Blocks beyond that go to a
+ * shared free list per numa node and size class, which is where the caches of
+ * finished connection threads end up, so the next connection on that node
+ * reuses them instead of calling malloc. The shared lists are capped so a burst
+ * of connections does not keep its memory forever.
+ */
+#include "buf_pool.h"
+#include "placement.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define NUM_SIZE_CLASSES (BUF_POOL_MAX_SHIFT - BUF_POOL_MIN_SHIFT + 1)
+#define THREAD_CACHE_MAX_BLOCKS 4
+#define SHARED_LIST_MAX_BLOCKS 64
+
+// free blocks are linked through their first bytes
+struct free_block_s
+{
+    struct free_block_s * p_next;
+};
+
+struct free_list_s
+{
+    struct free_block_s * p_head;
+    unsigned int num_blocks;
+};
+
+struct shared_free_list_s
+{
+    pthread_mutex_t lock;
+    struct free_list_s list;
+};
+
+static __thread struct free_list_s thread_cache[NUM_SIZE_CLASSES];
+static struct shared_free_list_s shared_lists[PLACEMENT_MAX_NODES][NUM_SIZE_CLASSES];
+static pthread_once_t shared_lists_once = PTHREAD_ONCE_INIT;
+
+static void init_shared_lists(void)
+{
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+    {
+        for (int size_class = 0; size_class < NUM_SIZE_CLASSES; size_class++)
+        {
+            pthread_mutex_init(&shared_lists[node][size_class].lock, NULL);
+        }
+    }
+}
+
+// @brief size class holding blocks of at least size bytes, -1 if size is not pooled
+static int size_to_class(const size_t size)
+{
+    if (size > BUF_POOL_MAX_SIZE)
+    {
+        return -1;
+    }
+
+    int size_class = 0;
+    while ((BUF_POOL_MIN_SIZE << size_class) < size)
+    {
+        size_class++;
+    }
+    return size_class;
+}
+
+// @brief shared list of the current node for size_class, NULL if the node has
+// none, its blocks then go straight to and from malloc instead of another node's list
+static struct shared_free_list_s * shared_list_for(const int size_class)
+{
+    int node = placement_current_node();
+
+    if ((node < 0) || (node >= PLACEMENT_MAX_NODES))
+    {
+        return NULL;
+    }
+    pthread_once(&shared_lists_once, init_shared_lists);
+    return &shared_lists[node][size_class];
+}
+
+static struct free_block_s * pop_block(struct free_list_s * const p_list)
+{
+    struct free_block_s * p_block = p_list->p_head;
+    if (NULL != p_block)
+    {
+        p_list->p_head = p_block->p_next;
+        p_list->num_blocks--;
+    }
+    return p_block;
+}
+
+static void push_block(struct free_list_s * const p_list, struct free_block_s * const p_block)
+{
+    p_block->p_next = p_list->p_head;
+    p_list->p_head = p_block;
+    p_list->num_blocks++;
+}
+
+// @brief hand p_block to the shared list of the current node, or back to malloc
+// if that list is full or the node has none
+static void release_to_shared(struct free_block_s * const p_block, const int size_class)
+{
+    struct shared_free_list_s * p_shared = shared_list_for(size_class);
+    bool b_pooled = false;
+
+    if (NULL != p_shared)
+    {
+        pthread_mutex_lock(&p_shared->lock);
+        if (p_shared->list.num_blocks < SHARED_LIST_MAX_BLOCKS)
+        {
+            push_block(&p_shared->list, p_block);
+            b_pooled = true;
+        }
+        pthread_mutex_unlock(&p_shared->lock);
+    }
+
+    if (!b_pooled)
+    {
+        free(p_block);
+    }
+}
+
+// @brief count an allocation in the stats of the current node
+static void count_alloc(const bool b_reused)
+{
+    stats_node_add(placement_current_node(), b_reused ? NODE_STAT_POOL_REUSES : NODE_STAT_POOL_MALLOCS, 1);
+}
+
+/**
+ * Allocate a buffer of at least @param size bytes
+ * @param p_capacity is set to the usable size of the returned buffer, which must
+ *      be passed back to buf_pool_free or buf_pool_grow
+ * @return the buffer, or NULL if allocation failed
+ */
+void * buf_pool_alloc(const size_t size, size_t * const p_capacity)
+{
+    int size_class = size_to_class(size);
+    void * p_buf = NULL;
+
+    if (-1 == size_class)
+    {
+        // too large to pool
+        *p_capacity = size;
+        count_alloc(false);
+        return malloc(size);
+    }
+
+    *p_capacity = BUF_POOL_MIN_SIZE << size_class;
+    p_buf = pop_block(&thread_cache[size_class]);
+    struct shared_free_list_s * p_shared = (NULL == p_buf) ? shared_list_for(size_class) : NULL;
+    if (NULL != p_shared)
+    {
+        pthread_mutex_lock(&p_shared->lock);
+        p_buf = pop_block(&p_shared->list);
+        pthread_mutex_unlock(&p_shared->lock);
+    }
+
+    count_alloc(NULL != p_buf);
+    if (NULL == p_buf)
+    {
+        p_buf = malloc(*p_capacity);
+    }
+
+    return p_buf;
+}
+
+/**
+ * Return @param p_buf to the pool, @param capacity is either the capacity reported
+ * by buf_pool_alloc or the size originally requested, both map to the same class
+ */
+void buf_pool_free(void * const p_buf, const size_t capacity)
+{
+    if (NULL == p_buf)
+    {
+        return;
+    }
+
+    int size_class = size_to_class(capacity);
+    if (-1 == size_class)
+    {
+        free(p_buf);
+    }
+    else if (thread_cache[size_class].num_blocks < THREAD_CACHE_MAX_BLOCKS)
+    {
+        push_block(&thread_cache[size_class], p_buf);
+    }
+    else
+    {
+        release_to_shared(p_buf, size_class);
+    }
+}
+
+/**
+ * Make sure @param p_buf can hold @param required bytes, the realloc of this pool.
+ * @param used bytes at the start of p_buf are preserved, p_buf may be NULL.
+ * @param p_capacity holds the current capacity and is updated on success
+ * @return the (possibly moved) buffer, or NULL if allocation failed, in which
+ *      case p_buf is left untouched
+ */
+void * buf_pool_grow(void * const p_buf, const size_t used, size_t * const p_capacity, const size_t required)
+{
+    if ((NULL != p_buf) && (required <= *p_capacity))
+    {
+        return p_buf;
+    }
+
+    // at least double, so a growing record does not move on every recv
+    size_t new_capacity;
+    size_t new_size = (required > 2 * (*p_capacity)) ? required : 2 * (*p_capacity);
+    void * p_new_buf = buf_pool_alloc(new_size, &new_capacity);
+    if (NULL == p_new_buf)
+    {
+        return NULL;
+    }
+
+    if (NULL != p_buf)
+    {
+        memcpy(p_new_buf, p_buf, used);
+        buf_pool_free(p_buf, *p_capacity);
+    }
+    *p_capacity = new_capacity;
+    return p_new_buf;
+}
+
+/**
+ * Move every block cached by the calling thread to the shared lists, called by
+ * threads about to exit so their blocks stay reusable
+ */
+void buf_pool_thread_flush(void)
+{
+    for (int size_class = 0; size_class < NUM_SIZE_CLASSES; size_class++)
+    {
+        struct free_block_s * p_block;
+        while (NULL != (p_block = pop_block(&thread_cache[size_class])))
+        {
+            release_to_shared(p_block, size_class);
+        }
+    }
+}
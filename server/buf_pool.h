@@ -0,0 +1,29 @@
+/*
+ * @file buf_pool.h
+ * @author krish shah
+ * @brief size class buffer pool used for aesdsocket connection state, receive
+ * buffers and writeback buffers
+ */
+#ifndef AESDSOCKET_BUF_POOL_H
+#define AESDSOCKET_BUF_POOL_H
+
+#include <stddef.h>
+
+/**
+ * Blocks are handed out in power of two size classes from BUF_POOL_MIN_SIZE to
+ * BUF_POOL_MAX_SIZE bytes, larger requests fall through to malloc/free
+ */
+#define BUF_POOL_MIN_SHIFT 6
+#define BUF_POOL_MAX_SHIFT 20
+#define BUF_POOL_MIN_SIZE (1UL << BUF_POOL_MIN_SHIFT)
+#define BUF_POOL_MAX_SIZE (1UL << BUF_POOL_MAX_SHIFT)
+
+extern void * buf_pool_alloc(const size_t size, size_t * const p_capacity);
+
+extern void buf_pool_free(void * const p_buf, const size_t capacity);
+
+extern void * buf_pool_grow(void * const p_buf, const size_t used, size_t * const p_capacity, const size_t required);
+
+extern void buf_pool_thread_flush(void);
+
+#endif /* AESDSOCKET_BUF_POOL_H */
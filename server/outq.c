@@ -0,0 +1,280 @@
+/*
+ * @file outq.c
+ * @author krish shah
+ * @brief bounded per connection output queue of aesdsocket writebacks. Each
+ * queue is only used by its connection's service thread, no locking needed
+ */
+#include "outq.h"
+#include "buf_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/socket.h>
+
+struct outq_seg_s
+{
+    STAILQ_ENTRY(outq_seg_s) entries;
+    char const * p_data;
+    size_t len;
+    size_t sent;
+    // the segment owns exactly one of these
+    struct snapshot_s snapshot;
+    void * p_block;
+    size_t block_size;
+};
+
+// @brief monotonic time in ms
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Fill @param p_config with the default watermarks, slow consumers are kept
+ */
+void outq_config_init(struct outq_config_s * const p_config)
+{
+    p_config->high_watermark = OUTQ_DEFAULT_HIGH_WATERMARK;
+    p_config->low_watermark = OUTQ_DEFAULT_LOW_WATERMARK;
+    p_config->slow_consumer_timeout_ms = 0;
+}
+
+/**
+ * Parse "high[,low[,timeout_ms]]" from the command line, watermarks in bytes.
+ * low defaults to a quarter of high
+ * @return false if @param p_arg is malformed or low is above high
+ */
+bool outq_config_parse(struct outq_config_s * const p_config, char const * const p_arg)
+{
+    char * p_end;
+    unsigned long long high = strtoull(p_arg, &p_end, 10);
+    unsigned long long low = high / 4;
+    unsigned long long timeout_ms = p_config->slow_consumer_timeout_ms;
+
+    if ((p_end == p_arg) || (0 == high))
+    {
+        return false;
+    }
+    if (',' == *p_end)
+    {
+        char const * p_low = p_end + 1;
+        low = strtoull(p_low, &p_end, 10);
+        if (p_end == p_low)
+        {
+            return false;
+        }
+        if (',' == *p_end)
+        {
+            char const * p_timeout = p_end + 1;
+            timeout_ms = strtoull(p_timeout, &p_end, 10);
+            if ((p_end == p_timeout) || (timeout_ms > UINT32_MAX))
+            {
+                return false;
+            }
+        }
+    }
+    if (('\0' != *p_end) || (low > high))
+    {
+        return false;
+    }
+
+    p_config->high_watermark = high;
+    p_config->low_watermark = low;
+    p_config->slow_consumer_timeout_ms = timeout_ms;
+    return true;
+}
+
+void outq_init(struct outq_s * const p_outq)
+{
+    STAILQ_INIT(&p_outq->segs);
+    p_outq->queued_bytes = 0;
+    p_outq->b_paused = false;
+    p_outq->progress_ms = 0;
+}
+
+// @brief release whatever p_seg owns, and the segment itself
+static void seg_free(struct outq_seg_s * const p_seg)
+{
+    if (NULL != p_seg->snapshot.p_buf)
+    {
+        snapshot_put(&p_seg->snapshot);
+    }
+    buf_pool_free(p_seg->p_block, p_seg->block_size);
+    buf_pool_free(p_seg, sizeof(struct outq_seg_s));
+}
+
+/**
+ * Drop everything still queued in @param p_outq
+ */
+void outq_destroy(struct outq_s * const p_outq)
+{
+    while (!STAILQ_EMPTY(&p_outq->segs))
+    {
+        struct outq_seg_s * p_seg = STAILQ_FIRST(&p_outq->segs);
+        STAILQ_REMOVE_HEAD(&p_outq->segs, entries);
+        seg_free(p_seg);
+    }
+    p_outq->queued_bytes = 0;
+}
+
+// @brief append a zeroed segment of len bytes to p_outq, NULL if out of memory
+static struct outq_seg_s * push_seg(struct outq_s * const p_outq, const size_t len)
+{
+    size_t seg_size;
+    struct outq_seg_s * p_seg = buf_pool_alloc(sizeof(struct outq_seg_s), &seg_size);
+    if (NULL == p_seg)
+    {
+        syslog(LOG_ERR, "could not allocate output queue segment");
+        return NULL;
+    }
+
+    memset(p_seg, 0, sizeof(*p_seg));
+    p_seg->len = len;
+    STAILQ_INSERT_TAIL(&p_outq->segs, p_seg, entries);
+    p_outq->queued_bytes += len;
+    return p_seg;
+}
+
+/**
+ * Queue @param len bytes at @param offset of @param p_snapshot. The queue takes
+ * over the snapshot reference, also on failure
+ */
+bool outq_push_snapshot(struct outq_s * const p_outq, struct snapshot_s * const p_snapshot, const size_t offset,
+                        const size_t len)
+{
+    struct outq_seg_s * p_seg = push_seg(p_outq, len);
+    if (NULL == p_seg)
+    {
+        snapshot_put(p_snapshot);
+        return false;
+    }
+
+    p_seg->snapshot = *p_snapshot;
+    p_seg->p_data = p_snapshot->p_data + offset;
+    memset(p_snapshot, 0, sizeof(*p_snapshot));
+    return true;
+}
+
+/**
+ * Queue @param len bytes at @param offset of buf_pool block @param p_block of
+ * @param block_size bytes. The queue takes over the block, also on failure
+ */
+bool outq_push_block(struct outq_s * const p_outq, void * const p_block, const size_t block_size, const size_t offset,
+                     const size_t len)
+{
+    struct outq_seg_s * p_seg = push_seg(p_outq, len);
+    if (NULL == p_seg)
+    {
+        buf_pool_free(p_block, block_size);
+        return false;
+    }
+
+    p_seg->p_block = p_block;
+    p_seg->block_size = block_size;
+    p_seg->p_data = (char const *)p_block + offset;
+    return true;
+}
+
+/**
+ * Send as much of @param p_outq over @param h_sockfd as the socket takes
+ * without blocking, adding the bytes sent to @param p_bytes_sent
+ * @return false if the connection failed
+ */
+bool outq_flush(struct outq_s * const p_outq, const int h_sockfd, size_t * const p_bytes_sent)
+{
+    size_t queued_bytes = p_outq->queued_bytes;
+
+    while (!STAILQ_EMPTY(&p_outq->segs))
+    {
+        struct outq_seg_s * p_seg = STAILQ_FIRST(&p_outq->segs);
+
+        if (p_seg->sent < p_seg->len)
+        {
+            ssize_t bytes_written = send(h_sockfd, p_seg->p_data + p_seg->sent, p_seg->len - p_seg->sent,
+                                         MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (-1 == bytes_written)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+                {
+                    break;
+                }
+                syslog(LOG_ERR, "send failed with error %s", strerror(errno));
+                return false;
+            }
+            p_seg->sent += bytes_written;
+            p_outq->queued_bytes -= bytes_written;
+            *p_bytes_sent += bytes_written;
+        }
+
+        if (p_seg->sent == p_seg->len)
+        {
+            STAILQ_REMOVE_HEAD(&p_outq->segs, entries);
+            seg_free(p_seg);
+        }
+    }
+
+    // the client is reading, it is not a slow consumer however much is queued
+    if (p_outq->b_paused && (p_outq->queued_bytes < queued_bytes))
+    {
+        p_outq->progress_ms = now_ms();
+    }
+
+    return true;
+}
+
+/**
+ * Pause @param p_outq when it grew over the high watermark, resume it once it
+ * drained to the low watermark
+ * @param p_b_paused_now set if this call paused the queue, to count overflows
+ * @return true while the connection should not be read from
+ */
+bool outq_update_backpressure(struct outq_s * const p_outq, struct outq_config_s const * const p_config,
+                              bool * const p_b_paused_now)
+{
+    *p_b_paused_now = false;
+
+    if (!p_outq->b_paused && (p_outq->queued_bytes > p_config->high_watermark))
+    {
+        p_outq->b_paused = true;
+        p_outq->progress_ms = now_ms();
+        *p_b_paused_now = true;
+    }
+    else if (p_outq->b_paused && (p_outq->queued_bytes <= p_config->low_watermark))
+    {
+        p_outq->b_paused = false;
+    }
+
+    return p_outq->b_paused;
+}
+
+/**
+ * @return true if @param p_outq is paused and sent nothing for the slow consumer
+ * timeout. Otherwise @param p_timeout_ms is set to the ms left till that
+ * happens, -1 if it cannot
+ */
+bool outq_is_slow_consumer(struct outq_s const * const p_outq, struct outq_config_s const * const p_config,
+                           int * const p_timeout_ms)
+{
+    *p_timeout_ms = -1;
+
+    if (!p_outq->b_paused || (0 == p_config->slow_consumer_timeout_ms))
+    {
+        return false;
+    }
+
+    uint64_t stalled_ms = now_ms() - p_outq->progress_ms;
+    if (stalled_ms >= p_config->slow_consumer_timeout_ms)
+    {
+        return true;
+    }
+    *p_timeout_ms = (int)(p_config->slow_consumer_timeout_ms - stalled_ms);
+    return false;
+}
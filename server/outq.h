@@ -0,0 +1,75 @@
+/*
+ * @file outq.h
+ * @author krish shah
+ * @brief bounded per connection output queue of aesdsocket writebacks, sent
+ * without blocking. Segments either hold a reference on a log snapshot or own
+ * a buf_pool block, so queueing a writeback never copies it
+ */
+#ifndef AESDSOCKET_OUTQ_H
+#define AESDSOCKET_OUTQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include "snapshot.h"
+
+#define OUTQ_DEFAULT_HIGH_WATERMARK (4UL << 20)
+#define OUTQ_DEFAULT_LOW_WATERMARK (1UL << 20)
+
+struct outq_seg_s;
+
+struct outq_config_s
+{
+    /**
+     * a connection with more bytes queued than high_watermark is not read from,
+     * records it already sent are not processed, till the queue drains to
+     * low_watermark
+     */
+    size_t high_watermark;
+    size_t low_watermark;
+    /**
+     * a connection over high_watermark that did not read any of its queue for
+     * this long is disconnected, 0 keeps slow consumers connected. A client
+     * still reading is kept, a single writeback may be larger than high_watermark
+     */
+    unsigned int slow_consumer_timeout_ms;
+};
+
+struct outq_s
+{
+    STAILQ_HEAD(outq_seg_list_s, outq_seg_s) segs;
+    size_t queued_bytes;
+    /**
+     * set from crossing the high watermark till draining to the low one
+     */
+    bool b_paused;
+    /**
+     * when the queue was paused, or last sent bytes while paused
+     */
+    uint64_t progress_ms;
+};
+
+extern void outq_config_init(struct outq_config_s * const p_config);
+
+extern bool outq_config_parse(struct outq_config_s * const p_config, char const * const p_arg);
+
+extern void outq_init(struct outq_s * const p_outq);
+
+extern void outq_destroy(struct outq_s * const p_outq);
+
+extern bool outq_push_snapshot(struct outq_s * const p_outq, struct snapshot_s * const p_snapshot, const size_t offset,
+                               const size_t len);
+
+extern bool outq_push_block(struct outq_s * const p_outq, void * const p_block, const size_t block_size,
+                            const size_t offset, const size_t len);
+
+extern bool outq_flush(struct outq_s * const p_outq, const int h_sockfd, size_t * const p_bytes_sent);
+
+extern bool outq_update_backpressure(struct outq_s * const p_outq, struct outq_config_s const * const p_config,
+                                     bool * const p_b_paused_now);
+
+extern bool outq_is_slow_consumer(struct outq_s const * const p_outq, struct outq_config_s const * const p_config,
+                                  int * const p_timeout_ms);
+
+#endif /* AESDSOCKET_OUTQ_H */
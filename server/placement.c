@@ -0,0 +1,221 @@
+/*
+ * @file placement.c
+ * @author krish shah
+ * @brief pins the acceptor thread and service threads to user supplied cpu sets.
+ * Service threads are pinned to the cpus of a single numa node each, so the
+ * connection buffers they allocate and first touch are placed on their local node
+ * by the kernel's default first touch policy, without depending on libnuma
+ */
+#include "placement.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+
+#define NODE_CPULIST_PATH_FMT "/sys/devices/system/node/node%d/cpulist"
+#define CPULIST_LEN 4096
+
+/**
+ * Parse a cpu list like "0-3,8,10-11" (the format used by taskset -c and sysfs)
+ * into @param p_cpu_set
+ * @return false if @param p_cpu_list is malformed or selects no cpu
+ */
+bool placement_parse_cpu_list(char const * const p_cpu_list, cpu_set_t * const p_cpu_set)
+{
+    char const * p_pos = p_cpu_list;
+
+    CPU_ZERO(p_cpu_set);
+    while ('\0' != *p_pos && '\n' != *p_pos)
+    {
+        char * p_end;
+        errno = 0;
+        unsigned long first_cpu = strtoul(p_pos, &p_end, 10);
+        unsigned long last_cpu = first_cpu;
+        if ((p_end == p_pos) || (0 != errno))
+        {
+            return false;
+        }
+        p_pos = p_end;
+
+        if ('-' == *p_pos)
+        {
+            p_pos++;
+            last_cpu = strtoul(p_pos, &p_end, 10);
+            if ((p_end == p_pos) || (0 != errno) || (last_cpu < first_cpu))
+            {
+                return false;
+            }
+            p_pos = p_end;
+        }
+
+        if (last_cpu >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for (unsigned long cpu = first_cpu; cpu <= last_cpu; cpu++)
+        {
+            CPU_SET(cpu, p_cpu_set);
+        }
+
+        if (',' == *p_pos)
+        {
+            p_pos++;
+        }
+        else if (('\0' != *p_pos) && ('\n' != *p_pos))
+        {
+            return false;
+        }
+    }
+
+    return CPU_COUNT(p_cpu_set) > 0;
+}
+
+// @brief read the cpus belonging to numa node node_id from sysfs
+static bool read_node_cpus(const int node_id, cpu_set_t * const p_cpu_set)
+{
+    char path[64];
+    char cpulist[CPULIST_LEN];
+    bool b_status = false;
+
+    snprintf(path, sizeof(path), NODE_CPULIST_PATH_FMT, node_id);
+    FILE * ph_file = fopen(path, "r");
+    if (NULL != ph_file)
+    {
+        if (NULL != fgets(cpulist, sizeof(cpulist), ph_file))
+        {
+            b_status = placement_parse_cpu_list(cpulist, p_cpu_set);
+        }
+        fclose(ph_file);
+    }
+
+    return b_status;
+}
+
+// @brief split p_worker_cpus by numa node into p_placement->worker_node_cpus,
+// everything is treated as one node if the kernel exposes no numa topology
+static void split_worker_cpus_by_node(struct placement_s * const p_placement, cpu_set_t const * const p_worker_cpus)
+{
+    cpu_set_t node_cpus;
+
+    p_placement->num_worker_nodes = 0;
+    for (int node_id = 0; (node_id < PLACEMENT_MAX_NODES) && (p_placement->num_worker_nodes < PLACEMENT_MAX_NODES); node_id++)
+    {
+        if (!read_node_cpus(node_id, &node_cpus))
+        {
+            continue;
+        }
+
+        int idx = p_placement->num_worker_nodes;
+        CPU_AND(&p_placement->worker_node_cpus[idx], &node_cpus, p_worker_cpus);
+        if (CPU_COUNT(&p_placement->worker_node_cpus[idx]) > 0)
+        {
+            p_placement->worker_node_ids[idx] = node_id;
+            p_placement->num_worker_nodes++;
+        }
+    }
+
+    if (0 == p_placement->num_worker_nodes)
+    {
+        p_placement->worker_node_ids[0] = 0;
+        p_placement->worker_node_cpus[0] = *p_worker_cpus;
+        p_placement->num_worker_nodes = 1;
+    }
+}
+
+/**
+ * Initialize @param p_placement from the cpu lists given on the command line,
+ * either list may be NULL to leave those threads unpinned
+ */
+bool placement_init(struct placement_s * const p_placement, char const * const p_acceptor_cpu_list,
+                    char const * const p_worker_cpu_list)
+{
+    memset(p_placement, 0, sizeof(*p_placement));
+
+    if (NULL != p_acceptor_cpu_list)
+    {
+        if (!placement_parse_cpu_list(p_acceptor_cpu_list, &p_placement->acceptor_cpus))
+        {
+            syslog(LOG_ERR, "invalid acceptor cpu list %s", p_acceptor_cpu_list);
+            return false;
+        }
+        p_placement->b_pin_acceptor = true;
+    }
+
+    if (NULL != p_worker_cpu_list)
+    {
+        cpu_set_t worker_cpus;
+        if (!placement_parse_cpu_list(p_worker_cpu_list, &worker_cpus))
+        {
+            syslog(LOG_ERR, "invalid worker cpu list %s", p_worker_cpu_list);
+            return false;
+        }
+        split_worker_cpus_by_node(p_placement, &worker_cpus);
+        p_placement->b_pin_workers = true;
+
+        for (int idx = 0; idx < p_placement->num_worker_nodes; idx++)
+        {
+            syslog(LOG_DEBUG, "service threads on node %d get %d cpus", p_placement->worker_node_ids[idx],
+                   CPU_COUNT(&p_placement->worker_node_cpus[idx]));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Pin the calling thread to the acceptor cpu set, if one was given
+ */
+bool placement_pin_acceptor(struct placement_s const * const p_placement)
+{
+    bool b_status = true;
+
+    if (p_placement->b_pin_acceptor)
+    {
+        int return_code = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &p_placement->acceptor_cpus);
+        if (return_code != 0)
+        {
+            syslog(LOG_ERR, "pthread_setaffinity_np failed with error %s", strerror(return_code));
+            b_status = false;
+        }
+    }
+
+    return b_status;
+}
+
+/**
+ * Set the affinity of the next service thread in @param p_attr. Consecutive calls
+ * hand out the worker numa nodes round robin. Only called from the acceptor thread.
+ */
+bool placement_set_worker_attr(struct placement_s * const p_placement, pthread_attr_t * const p_attr)
+{
+    bool b_status = true;
+
+    if (p_placement->b_pin_workers)
+    {
+        unsigned int idx = p_placement->next_worker_node++ % p_placement->num_worker_nodes;
+        int return_code = pthread_attr_setaffinity_np(p_attr, sizeof(cpu_set_t), &p_placement->worker_node_cpus[idx]);
+        if (return_code != 0)
+        {
+            syslog(LOG_ERR, "pthread_attr_setaffinity_np failed with error %s", strerror(return_code));
+            b_status = false;
+        }
+    }
+
+    return b_status;
+}
+
+/**
+ * @return the numa node the calling thread currently runs on, 0 if unknown
+ */
+int placement_current_node(void)
+{
+    unsigned int cpu;
+    unsigned int node;
+
+    if (-1 == getcpu(&cpu, &node))
+    {
+        return 0;
+    }
+    return (int)node;
+}
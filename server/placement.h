@@ -0,0 +1,53 @@
+/*
+ * @file placement.h
+ * @author krish shah
+ * @brief cpu affinity and numa node placement of the aesdsocket acceptor and
+ * service threads
+ */
+#ifndef AESDSOCKET_PLACEMENT_H
+#define AESDSOCKET_PLACEMENT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdbool.h>
+#include <sched.h>
+#include <pthread.h>
+
+/**
+ * numa node ids below this are used, for worker placement and for the per node
+ * state of the buffer pool and stats
+ */
+#define PLACEMENT_MAX_NODES 64
+
+struct placement_s
+{
+    /**
+     * cpus the acceptor (main) thread is pinned to, if b_pin_acceptor is set
+     */
+    bool b_pin_acceptor;
+    cpu_set_t acceptor_cpus;
+    /**
+     * cpus service threads may run on, if b_pin_workers is set. The set is split
+     * per numa node, and each new service thread is pinned to the cpus of one
+     * node, round robin, so everything it allocates stays on that node
+     */
+    bool b_pin_workers;
+    int num_worker_nodes;
+    int worker_node_ids[PLACEMENT_MAX_NODES];
+    cpu_set_t worker_node_cpus[PLACEMENT_MAX_NODES];
+    unsigned int next_worker_node;
+};
+
+extern bool placement_parse_cpu_list(char const * const p_cpu_list, cpu_set_t * const p_cpu_set);
+
+extern bool placement_init(struct placement_s * const p_placement, char const * const p_acceptor_cpu_list,
+                           char const * const p_worker_cpu_list);
+
+extern bool placement_pin_acceptor(struct placement_s const * const p_placement);
+
+extern bool placement_set_worker_attr(struct placement_s * const p_placement, pthread_attr_t * const p_attr);
+
+extern int placement_current_node(void);
+
+#endif /* AESDSOCKET_PLACEMENT_H */
@@ -0,0 +1,72 @@
+/*
+ * @file probes.h
+ * @author krish shah
+ * @brief USDT static probes for aesdsocket, provider "aesdsocket". Every probe has
+ * an sdt semaphore, which tracers like bpftrace -p set while they are attached,
+ * so timestamps for the duration arguments are only taken when a tracer listens.
+ * A disabled probe costs a nop and a predicted branch. Without <sys/sdt.h>
+ * (systemtap-sdt-dev) the probes compile to nothing.
+ *
+ * Probes and arguments (durations in ns):
+ *   accept(fd)
+ *   recv(fd, bytes)
+ *   record_complete(fd, record_bytes, assembly_ns)
+ *   lock_acquire(fd, record_bytes)
+ *   lock_acquired(fd, wait_ns)
+ *   store_append(fd, bytes, append_ns)
+ *   writeback_start(fd)
+ *   writeback_end(fd, bytes, writeback_ns)
+ *   lock_release(fd, hold_ns)
+ *   close(fd, bytes_received, bytes_sent, connection_ns)
+ *
+ * writeback_end fires once the writeback is queued, bytes is its length. It is
+ * sent from the output queue of the connection, see outq.h.
+ */
+#ifndef AESDSOCKET_PROBES_H
+#define AESDSOCKET_PROBES_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(AESDSOCKET_NO_PROBES)
+#define AESDSOCKET_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef AESDSOCKET_HAVE_PROBES
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define AESD_PROBE_SEMAPHORE(name) \
+    __extension__ unsigned short aesdsocket_##name##_semaphore __attribute__((unused)) __attribute__((section(".probes")))
+#define AESD_PROBE_ENABLED(name) __builtin_expect(aesdsocket_##name##_semaphore != 0, 0)
+#define AESD_PROBE1(name, a1) STAP_PROBE1(aesdsocket, name, a1)
+#define AESD_PROBE2(name, a1, a2) STAP_PROBE2(aesdsocket, name, a1, a2)
+#define AESD_PROBE3(name, a1, a2, a3) STAP_PROBE3(aesdsocket, name, a1, a2, a3)
+#define AESD_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(aesdsocket, name, a1, a2, a3, a4)
+#else
+#define AESD_PROBE_SEMAPHORE(name) extern int aesdsocket_##name##_unused
+#define AESD_PROBE_ENABLED(name) 0
+// arguments stay referenced so variables only feeding probes do not warn
+#define AESD_PROBE1(name, a1) do { if (0) { (void)(a1); } } while (0)
+#define AESD_PROBE2(name, a1, a2) do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define AESD_PROBE3(name, a1, a2, a3) do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define AESD_PROBE4(name, a1, a2, a3, a4) do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+#endif
+
+// @brief timestamp for probe durations, only taken if probe name is enabled
+#define AESD_PROBE_TIMESTAMP(name) (AESD_PROBE_ENABLED(name) ? aesd_probe_now_ns() : 0)
+
+// @brief ns elapsed since start_ns, 0 if the start was not recorded because the
+// probe was enabled in between
+#define AESD_PROBE_ELAPSED(start_ns) ((0 != (start_ns)) ? aesd_probe_now_ns() - (start_ns) : 0)
+
+static inline uint64_t aesd_probe_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* AESDSOCKET_PROBES_H */
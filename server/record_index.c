@@ -0,0 +1,192 @@
+/*
+ * @file record_index.c
+ * @author krish shah
+ * @brief offsets of the newline terminated records in the aesdsocket data file.
+ * Appends only look at the bytes being appended, lookups are O(1), time range
+ * lookups O(log n).
+ * Any necessary locking must be performed by the caller.
+ */
+#include "record_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_INDEX_INIT_CAPACITY 1024
+
+/**
+ * Initialize @param p_index to an empty index for an empty file
+ */
+void record_index_init(struct record_index_s * const p_index)
+{
+    memset(p_index, 0, sizeof(*p_index));
+}
+
+void record_index_destroy(struct record_index_s * const p_index)
+{
+    free(p_index->p_offsets);
+    free(p_index->p_meta);
+    record_index_init(p_index);
+}
+
+// @brief make room for one more offset and sidecar entry
+static bool reserve_entry(struct record_index_s * const p_index)
+{
+    if (p_index->count == p_index->capacity)
+    {
+        size_t new_capacity = (0 == p_index->capacity) ? RECORD_INDEX_INIT_CAPACITY : 2 * p_index->capacity;
+        uint64_t * p_tmp = realloc(p_index->p_offsets, new_capacity * sizeof(uint64_t));
+        if (NULL == p_tmp)
+        {
+            return false;
+        }
+        p_index->p_offsets = p_tmp;
+
+        struct record_meta_s * p_tmp_meta = realloc(p_index->p_meta, new_capacity * sizeof(struct record_meta_s));
+        if (NULL == p_tmp_meta)
+        {
+            return false;
+        }
+        p_index->p_meta = p_tmp_meta;
+        p_index->capacity = new_capacity;
+    }
+    return true;
+}
+
+/**
+ * Account for @param len bytes at @param p_data appended to the end of the file.
+ * Every newline in the data completes a record. Bytes after the last newline
+ * belong to a record that is completed by a later append.
+ * @param p_meta sidecar entry of the records this append completes, NULL if
+ * unknown. A commit time older than the newest record is raised to its time,
+ * to keep the index sorted by time
+ * @return false if the index could not grow, the index then misses records
+ */
+bool record_index_append(struct record_index_s * const p_index, char const * const p_data, const size_t len,
+                         struct record_meta_s const * const p_meta)
+{
+    bool b_status = true;
+    char const * p_pos = p_data;
+    char const * const p_end = p_data + len;
+    char const * p_newline;
+    struct record_meta_s meta = {0};
+
+    if (NULL != p_meta)
+    {
+        meta = *p_meta;
+    }
+    if ((p_index->count > 0) && (meta.commit_ns < p_index->p_meta[p_index->count - 1].commit_ns))
+    {
+        meta.commit_ns = p_index->p_meta[p_index->count - 1].commit_ns;
+    }
+
+    while ((p_pos < p_end) && (NULL != (p_newline = memchr(p_pos, '\n', p_end - p_pos))))
+    {
+        if (!reserve_entry(p_index))
+        {
+            b_status = false;
+            break;
+        }
+        p_index->p_meta[p_index->count] = meta;
+        p_index->p_offsets[p_index->count++] = p_index->end_offset;
+        p_index->end_offset = p_index->size + (p_newline - p_data) + 1;
+        p_pos = p_newline + 1;
+    }
+    p_index->size += len;
+
+    return b_status;
+}
+
+/**
+ * Byte range [@param p_start_offset, @param p_end_offset) of records
+ * @param first to @param last inclusive, counted from 0 for the oldest record.
+ * @param last is clamped to the newest record.
+ * @return false if @param first is not a record or @param last < @param first
+ */
+bool record_index_range(struct record_index_s const * const p_index, const size_t first, const size_t last,
+                        uint64_t * const p_start_offset, uint64_t * const p_end_offset)
+{
+    if ((first >= p_index->count) || (last < first))
+    {
+        return false;
+    }
+
+    *p_start_offset = p_index->p_offsets[first];
+    // compared against count - 1, last + 1 wraps for last == SIZE_MAX
+    *p_end_offset = (last < p_index->count - 1) ? p_index->p_offsets[last + 1] : p_index->end_offset;
+    return true;
+}
+
+/**
+ * Byte range of the complete records from @param offset to the newest record
+ * @return false if @param offset is past the last complete record
+ */
+bool record_index_from(struct record_index_s const * const p_index, const uint64_t offset,
+                       uint64_t * const p_start_offset, uint64_t * const p_end_offset)
+{
+    if (offset >= p_index->end_offset)
+    {
+        return false;
+    }
+
+    *p_start_offset = offset;
+    *p_end_offset = p_index->end_offset;
+    return true;
+}
+
+// @brief index of the first record committed at or after time_ns, count if none
+static size_t lower_bound_time(struct record_index_s const * const p_index, const uint64_t time_ns)
+{
+    size_t low = 0;
+    size_t high = p_index->count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (p_index->p_meta[mid].commit_ns < time_ns)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Byte range of the records committed from CLOCK_MONOTONIC time @param from_ns
+ * to @param to_ns inclusive. Records with an unknown commit time never match
+ * @return false if no record was committed in that time
+ */
+bool record_index_time_range(struct record_index_s const * const p_index, const uint64_t from_ns,
+                             const uint64_t to_ns, uint64_t * const p_start_offset, uint64_t * const p_end_offset)
+{
+    if ((to_ns < from_ns) || (0 == to_ns))
+    {
+        return false;
+    }
+
+    size_t first = lower_bound_time(p_index, (0 == from_ns) ? 1 : from_ns);
+    size_t end = (UINT64_MAX == to_ns) ? p_index->count : lower_bound_time(p_index, to_ns + 1);
+    if (first >= end)
+    {
+        return false;
+    }
+    return record_index_range(p_index, first, end - 1, p_start_offset, p_end_offset);
+}
+
+/**
+ * Byte range of the newest @param num_records records, all records if fewer exist
+ * @return false if the index is empty or @param num_records is 0
+ */
+bool record_index_tail(struct record_index_s const * const p_index, const size_t num_records,
+                       uint64_t * const p_start_offset, uint64_t * const p_end_offset)
+{
+    if ((0 == num_records) || (0 == p_index->count))
+    {
+        return false;
+    }
+
+    size_t first = (num_records >= p_index->count) ? 0 : p_index->count - num_records;
+    return record_index_range(p_index, first, p_index->count - 1, p_start_offset, p_end_offset);
+}
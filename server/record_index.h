@@ -0,0 +1,75 @@
+/*
+ * @file record_index.h
+ * @author krish shah
+ * @brief offsets of the newline terminated records in the aesdsocket data file,
+ * so record ranges can be located without scanning the file. Every record has a
+ * sidecar entry with its commit time and client, so time ranges are located by
+ * binary search
+ */
+#ifndef AESDSOCKET_RECORD_INDEX_H
+#define AESDSOCKET_RECORD_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORD_CLIENT_ADDR_LEN 16
+
+/**
+ * sidecar entry of a record, its length follows from the offsets
+ */
+struct record_meta_s
+{
+    /**
+     * CLOCK_MONOTONIC ns the record was committed at, non decreasing from the
+     * oldest to the newest record, 0 if unknown, e.g. for records loaded from an
+     * existing file
+     */
+    uint64_t commit_ns;
+    /**
+     * IPv6 address, IPv4 mapped, of the client that sent the record, all zero
+     * for records of the server itself and of unix domain socket clients
+     */
+    uint8_t client_addr[RECORD_CLIENT_ADDR_LEN];
+};
+
+struct record_index_s
+{
+    /**
+     * start offset and sidecar entry of every complete record, oldest first
+     */
+    uint64_t * p_offsets;
+    struct record_meta_s * p_meta;
+    size_t count;
+    size_t capacity;
+    /**
+     * offset one past the last complete record
+     */
+    uint64_t end_offset;
+    /**
+     * bytes in the file, including a trailing partial record
+     */
+    uint64_t size;
+};
+
+extern void record_index_init(struct record_index_s * const p_index);
+
+extern void record_index_destroy(struct record_index_s * const p_index);
+
+extern bool record_index_append(struct record_index_s * const p_index, char const * const p_data, const size_t len,
+                                struct record_meta_s const * const p_meta);
+
+extern bool record_index_range(struct record_index_s const * const p_index, const size_t first, const size_t last,
+                               uint64_t * const p_start_offset, uint64_t * const p_end_offset);
+
+extern bool record_index_from(struct record_index_s const * const p_index, const uint64_t offset,
+                              uint64_t * const p_start_offset, uint64_t * const p_end_offset);
+
+extern bool record_index_time_range(struct record_index_s const * const p_index, const uint64_t from_ns,
+                                    const uint64_t to_ns, uint64_t * const p_start_offset,
+                                    uint64_t * const p_end_offset);
+
+extern bool record_index_tail(struct record_index_s const * const p_index, const size_t num_records,
+                              uint64_t * const p_start_offset, uint64_t * const p_end_offset);
+
+#endif /* AESDSOCKET_RECORD_INDEX_H */
@@ -0,0 +1,417 @@
+/*
+ * @file sched.c
+ * @author krish shah
+ * @brief decides which connection commits its next record, or queues its next
+ * read response. Only one connection is granted at a time. Waiting connections
+ * are queued by priority class, the highest non empty class is always served
+ * first, and within a class deficit round robin hands out commits in proportion
+ * to bytes, so one client sending large records cannot starve clients sending
+ * small ones. Independently of that a client address can be held to a token
+ * bucket rate before it is queued.
+ */
+#define _GNU_SOURCE
+#include "sched.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+
+#define SCHED_DEFAULT_QUANTUM 4096
+#define SCHED_BUCKET_TABLE_SIZE 256
+#define SCHED_MAX_IDLE_BUCKETS 1024
+#define NSEC_PER_SEC 1000000000ULL
+
+TAILQ_HEAD(sched_queue_s, sched_client_s);
+
+struct sched_bucket_s
+{
+    char addr[SCHED_ADDR_STR_LEN];
+    double tokens;
+    uint64_t last_refill_ns;
+    unsigned int refcount;
+    struct sched_bucket_s * p_next;
+};
+
+static struct sched_config_s sched_config;
+
+// protects b_busy and the queues
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool b_busy = false;
+static struct sched_queue_s queues[SCHED_NUM_PRIORITIES];
+
+// protects the token bucket table
+static pthread_mutex_t bucket_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sched_bucket_s * bucket_table[SCHED_BUCKET_TABLE_SIZE];
+static unsigned int num_buckets = 0;
+
+static char const * const priority_names[SCHED_NUM_PRIORITIES] = {
+    [SCHED_PRIORITY_HIGH] = "high",
+    [SCHED_PRIORITY_NORMAL] = "normal",
+    [SCHED_PRIORITY_LOW] = "low",
+};
+
+// @brief monotonic time in ns
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Set @param p_config to the defaults: no rate limit, every client normal priority
+ */
+void sched_config_init(struct sched_config_s * const p_config)
+{
+    memset(p_config, 0, sizeof(*p_config));
+    p_config->quantum = SCHED_DEFAULT_QUANTUM;
+}
+
+/**
+ * Parse a "rate[,burst]" argument, both in bytes, burst defaults to one second worth of rate
+ */
+bool sched_config_parse_rate(struct sched_config_s * const p_config, char const * const p_arg)
+{
+    char * p_end;
+
+    errno = 0;
+    unsigned long long rate = strtoull(p_arg, &p_end, 10);
+    unsigned long long burst = rate;
+    if ((p_end == p_arg) || (0 != errno) || (0 == rate))
+    {
+        return false;
+    }
+
+    if (',' == *p_end)
+    {
+        char const * p_burst = p_end + 1;
+        burst = strtoull(p_burst, &p_end, 10);
+        if ((p_end == p_burst) || (0 != errno) || (0 == burst))
+        {
+            return false;
+        }
+    }
+
+    if ('\0' != *p_end)
+    {
+        return false;
+    }
+
+    p_config->rate_bytes_per_sec = rate;
+    p_config->burst_bytes = burst;
+    return true;
+}
+
+/**
+ * Parse an "address=class" argument, class is one of high, normal, low or 0-2
+ */
+bool sched_config_add_priority_rule(struct sched_config_s * const p_config, char const * const p_arg)
+{
+    char const * p_sep = strrchr(p_arg, '=');
+    size_t addr_len = (NULL != p_sep) ? (size_t)(p_sep - p_arg) : 0;
+    int priority = -1;
+
+    if ((0 == addr_len) || (addr_len >= SCHED_ADDR_STR_LEN) || (p_config->num_priority_rules >= SCHED_MAX_PRIORITY_RULES))
+    {
+        return false;
+    }
+
+    for (int idx = 0; idx < SCHED_NUM_PRIORITIES; idx++)
+    {
+        char digit[2] = {'0' + idx, '\0'};
+        if ((0 == strcmp(p_sep + 1, priority_names[idx])) || (0 == strcmp(p_sep + 1, digit)))
+        {
+            priority = idx;
+        }
+    }
+
+    if (-1 == priority)
+    {
+        return false;
+    }
+
+    int rule = p_config->num_priority_rules++;
+    memcpy(p_config->priority_rule_addrs[rule], p_arg, addr_len);
+    p_config->priority_rule_addrs[rule][addr_len] = '\0';
+    p_config->priority_rule_classes[rule] = priority;
+    return true;
+}
+
+/**
+ * Start scheduling with @param p_config, called once before the first connection
+ */
+void sched_init(struct sched_config_s const * const p_config)
+{
+    sched_config = *p_config;
+    for (int idx = 0; idx < SCHED_NUM_PRIORITIES; idx++)
+    {
+        TAILQ_INIT(&queues[idx]);
+    }
+}
+
+static unsigned int hash_addr(char const * p_addr)
+{
+    unsigned int hash = 5381;
+    while ('\0' != *p_addr)
+    {
+        hash = hash * 33 + (unsigned char)*p_addr++;
+    }
+    return hash % SCHED_BUCKET_TABLE_SIZE;
+}
+
+// @brief add tokens earned since the last refill, bucket_lock must be held
+static void refill_bucket(struct sched_bucket_s * const p_bucket, const uint64_t time_ns)
+{
+    p_bucket->tokens += (double)sched_config.rate_bytes_per_sec * (time_ns - p_bucket->last_refill_ns) / NSEC_PER_SEC;
+    if (p_bucket->tokens > sched_config.burst_bytes)
+    {
+        p_bucket->tokens = sched_config.burst_bytes;
+    }
+    p_bucket->last_refill_ns = time_ns;
+}
+
+// @brief drop buckets nobody uses that have refilled completely, they behave
+// exactly like a new bucket would. bucket_lock must be held
+static void evict_idle_buckets(void)
+{
+    uint64_t time_ns = now_ns();
+
+    for (int idx = 0; idx < SCHED_BUCKET_TABLE_SIZE; idx++)
+    {
+        struct sched_bucket_s ** pp_bucket = &bucket_table[idx];
+        while (NULL != *pp_bucket)
+        {
+            struct sched_bucket_s * p_bucket = *pp_bucket;
+            refill_bucket(p_bucket, time_ns);
+            if ((0 == p_bucket->refcount) && (p_bucket->tokens >= sched_config.burst_bytes))
+            {
+                *pp_bucket = p_bucket->p_next;
+                free(p_bucket);
+                num_buckets--;
+            }
+            else
+            {
+                pp_bucket = &p_bucket->p_next;
+            }
+        }
+    }
+}
+
+// @brief find or create the token bucket shared by all connections from p_addr_str
+static struct sched_bucket_s * get_bucket(char const * const p_addr_str)
+{
+    unsigned int idx = hash_addr(p_addr_str);
+    struct sched_bucket_s * p_bucket;
+
+    pthread_mutex_lock(&bucket_lock);
+    for (p_bucket = bucket_table[idx]; NULL != p_bucket; p_bucket = p_bucket->p_next)
+    {
+        if (0 == strcmp(p_bucket->addr, p_addr_str))
+        {
+            break;
+        }
+    }
+
+    if (NULL == p_bucket)
+    {
+        if (num_buckets >= SCHED_MAX_IDLE_BUCKETS)
+        {
+            evict_idle_buckets();
+        }
+
+        p_bucket = calloc(1, sizeof(*p_bucket));
+        if (NULL == p_bucket)
+        {
+            syslog(LOG_ERR, "calloc failed, %s is not rate limited", p_addr_str);
+        }
+        else
+        {
+            snprintf(p_bucket->addr, sizeof(p_bucket->addr), "%s", p_addr_str);
+            p_bucket->tokens = sched_config.burst_bytes;
+            p_bucket->last_refill_ns = now_ns();
+            p_bucket->p_next = bucket_table[idx];
+            bucket_table[idx] = p_bucket;
+            num_buckets++;
+        }
+    }
+
+    if (NULL != p_bucket)
+    {
+        p_bucket->refcount++;
+    }
+    pthread_mutex_unlock(&bucket_lock);
+
+    return p_bucket;
+}
+
+// @brief sleep till the bucket holds enough tokens for cost, then take them.
+// A cost above the burst size waits for a full bucket and leaves it in debt
+static void take_tokens(struct sched_bucket_s * const p_bucket, const size_t cost)
+{
+    const double needed = (cost < sched_config.burst_bytes) ? cost : sched_config.burst_bytes;
+
+    while (true)
+    {
+        pthread_mutex_lock(&bucket_lock);
+        refill_bucket(p_bucket, now_ns());
+        if (p_bucket->tokens >= needed)
+        {
+            p_bucket->tokens -= cost;
+            pthread_mutex_unlock(&bucket_lock);
+            return;
+        }
+        uint64_t wait_ns = (uint64_t)((needed - p_bucket->tokens) * NSEC_PER_SEC / sched_config.rate_bytes_per_sec) + 1;
+        pthread_mutex_unlock(&bucket_lock);
+
+        struct timespec wait_time = {.tv_sec = wait_ns / NSEC_PER_SEC, .tv_nsec = wait_ns % NSEC_PER_SEC};
+        nanosleep(&wait_time, NULL);
+    }
+}
+
+/**
+ * Set up the scheduling state of a new connection from @param p_addr_str,
+ * the address as printed by inet_ntop
+ */
+void sched_client_init(struct sched_client_s * const p_client, char const * const p_addr_str)
+{
+    memset(p_client, 0, sizeof(*p_client));
+    pthread_cond_init(&p_client->cond, NULL);
+    p_client->priority = SCHED_PRIORITY_NORMAL;
+
+    for (int rule = 0; rule < sched_config.num_priority_rules; rule++)
+    {
+        if (0 == strcmp(sched_config.priority_rule_addrs[rule], p_addr_str))
+        {
+            p_client->priority = sched_config.priority_rule_classes[rule];
+            break;
+        }
+    }
+
+    if (0 != sched_config.rate_bytes_per_sec)
+    {
+        p_client->p_bucket = get_bucket(p_addr_str);
+    }
+
+    syslog(LOG_DEBUG, "%s scheduled with %s priority%s", p_addr_str, priority_names[p_client->priority],
+           (NULL != p_client->p_bucket) ? ", rate limited" : "");
+}
+
+/**
+ * Release the scheduling state of a connection, it must not be waiting in sched_acquire
+ */
+void sched_client_destroy(struct sched_client_s * const p_client)
+{
+    if (NULL != p_client->p_bucket)
+    {
+        pthread_mutex_lock(&bucket_lock);
+        p_client->p_bucket->refcount--;
+        pthread_mutex_unlock(&bucket_lock);
+    }
+    pthread_cond_destroy(&p_client->cond);
+}
+
+// @brief pick the next client of p_queue by deficit round robin, sched_lock must be held
+static struct sched_client_s * pick_next_drr(struct sched_queue_s * const p_queue)
+{
+    const long quantum = sched_config.quantum;
+    struct sched_client_s * p_client;
+
+    // skip rounds in which nobody could be served, so large records do not
+    // cost one loop iteration per quantum
+    long min_rounds = -1;
+    TAILQ_FOREACH(p_client, p_queue, entries)
+    {
+        long missing = (long)p_client->pending_cost - p_client->deficit;
+        long rounds = (missing <= 0) ? 1 : (missing + quantum - 1) / quantum;
+        if ((-1 == min_rounds) || (rounds < min_rounds))
+        {
+            min_rounds = rounds;
+        }
+    }
+    if (min_rounds > 1)
+    {
+        TAILQ_FOREACH(p_client, p_queue, entries)
+        {
+            p_client->deficit += (min_rounds - 1) * quantum;
+        }
+    }
+
+    while (true)
+    {
+        p_client = TAILQ_FIRST(p_queue);
+        TAILQ_REMOVE(p_queue, p_client, entries);
+        p_client->deficit += quantum;
+        if (p_client->deficit >= (long)p_client->pending_cost)
+        {
+            // the client has nothing else queued once served, so like any DRR
+            // flow going idle it starts over with an empty deficit
+            p_client->deficit = 0;
+            return p_client;
+        }
+        TAILQ_INSERT_TAIL(p_queue, p_client, entries);
+    }
+}
+
+/**
+ * Block till @param p_client may commit a record, or queue a read response, of
+ * @param cost bytes, after waiting for its token bucket if it is rate limited.
+ * Must be paired with sched_release
+ */
+void sched_acquire(struct sched_client_s * const p_client, const size_t cost)
+{
+    if (NULL != p_client->p_bucket)
+    {
+        take_tokens(p_client->p_bucket, cost);
+    }
+
+    pthread_mutex_lock(&sched_lock);
+    p_client->pending_cost = cost;
+    p_client->b_granted = false;
+
+    bool b_queues_empty = true;
+    for (int idx = 0; idx < SCHED_NUM_PRIORITIES; idx++)
+    {
+        b_queues_empty = b_queues_empty && TAILQ_EMPTY(&queues[idx]);
+    }
+
+    if (!b_busy && b_queues_empty)
+    {
+        // uncontended, no need to queue
+        b_busy = true;
+        p_client->b_granted = true;
+    }
+    else
+    {
+        TAILQ_INSERT_TAIL(&queues[p_client->priority], p_client, entries);
+        while (!p_client->b_granted)
+        {
+            pthread_cond_wait(&p_client->cond, &sched_lock);
+        }
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+/**
+ * Hand the commit slot held by @param p_client to the next waiting connection
+ */
+void sched_release(struct sched_client_s * const p_client)
+{
+    (void)p_client;
+
+    pthread_mutex_lock(&sched_lock);
+    b_busy = false;
+    for (int idx = 0; idx < SCHED_NUM_PRIORITIES; idx++)
+    {
+        if (!TAILQ_EMPTY(&queues[idx]))
+        {
+            struct sched_client_s * p_next = pick_next_drr(&queues[idx]);
+            p_next->b_granted = true;
+            b_busy = true;
+            pthread_cond_signal(&p_next->cond);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * @file sched.h
+ * @author krish shah
+ * @brief fair scheduling of record commits and writebacks across aesdsocket
+ * connections: strict priority classes, deficit round robin between the
+ * connections of a class, and optional per client address token buckets
+ */
+#ifndef AESDSOCKET_SCHED_H
+#define AESDSOCKET_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#define SCHED_NUM_PRIORITIES 3
+#define SCHED_PRIORITY_HIGH 0
+#define SCHED_PRIORITY_NORMAL 1
+#define SCHED_PRIORITY_LOW 2
+#define SCHED_MAX_PRIORITY_RULES 32
+#define SCHED_ADDR_STR_LEN 46 // INET6_ADDRSTRLEN
+
+struct sched_bucket_s;
+
+/**
+ * Scheduling state of one connection, embedded in its thread args
+ */
+struct sched_client_s
+{
+    TAILQ_ENTRY(sched_client_s) entries;
+    pthread_cond_t cond;
+    struct sched_bucket_s * p_bucket; // NULL if rate limiting is off
+    int priority;
+    long deficit;
+    size_t pending_cost;
+    bool b_granted;
+};
+
+struct sched_config_s
+{
+    /**
+     * bytes added to a waiting connection's deficit per round
+     */
+    size_t quantum;
+    /**
+     * per client address token bucket, in bytes of records and read responses per second,
+     * 0 disables rate limiting
+     */
+    uint64_t rate_bytes_per_sec;
+    uint64_t burst_bytes;
+    /**
+     * priority class per client address, clients not listed are SCHED_PRIORITY_NORMAL
+     */
+    int num_priority_rules;
+    char priority_rule_addrs[SCHED_MAX_PRIORITY_RULES][SCHED_ADDR_STR_LEN];
+    int priority_rule_classes[SCHED_MAX_PRIORITY_RULES];
+};
+
+extern void sched_config_init(struct sched_config_s * const p_config);
+
+extern bool sched_config_parse_rate(struct sched_config_s * const p_config, char const * const p_arg);
+
+extern bool sched_config_add_priority_rule(struct sched_config_s * const p_config, char const * const p_arg);
+
+extern void sched_init(struct sched_config_s const * const p_config);
+
+extern void sched_client_init(struct sched_client_s * const p_client, char const * const p_addr_str);
+
+extern void sched_client_destroy(struct sched_client_s * const p_client);
+
+extern void sched_acquire(struct sched_client_s * const p_client, const size_t cost);
+
+extern void sched_release(struct sched_client_s * const p_client);
+
+#endif /* AESDSOCKET_SCHED_H */
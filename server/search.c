@@ -0,0 +1,395 @@
+/*
+ * @file search.c
+ * @author krish shah
+ * @brief substring search over aesdsocket records, see search.h. The SIMD
+ * variants are compiled with target attributes, so the rest of the server does
+ * not need -mavx2 and still runs on cpus without it
+ */
+#define _GNU_SOURCE
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syslog.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_HAVE_X86 1
+#endif
+
+#define SEARCH_INIT_CAPACITY 64
+// logs smaller than this per thread are not worth a thread
+#define SEARCH_SEGMENT_MIN_LEN (4UL << 20)
+#define SEARCH_MAX_THREADS 64
+
+// a part of the log scanned by one thread, starting and ending at record boundaries
+struct segment_s
+{
+    char const * p_data;
+    uint64_t start;
+    uint64_t end;
+    char const * p_pattern;
+    size_t pattern_len;
+    struct search_result_s result;
+    bool b_status;
+    pthread_t tid;
+    bool b_thread_started;
+};
+
+static pthread_once_t best_impl_once = PTHREAD_ONCE_INIT;
+static enum search_impl_e best_impl = SEARCH_IMPL_SCALAR;
+
+static char const * const impl_names[SEARCH_IMPL_COUNT] = {
+    [SEARCH_IMPL_SCALAR] = "scalar",
+    [SEARCH_IMPL_SSE2] = "sse2",
+    [SEARCH_IMPL_AVX2] = "avx2",
+};
+
+// @brief first occurrence of p_pattern in p_data, one position at a time
+static char const * find_scalar(char const * const p_data, const size_t len, char const * const p_pattern,
+                                const size_t pattern_len)
+{
+    if (len < pattern_len)
+    {
+        return NULL;
+    }
+
+    const char first = p_pattern[0];
+    const char last = p_pattern[pattern_len - 1];
+    for (size_t pos = 0; pos + pattern_len <= len; pos++)
+    {
+        if ((first == p_data[pos]) && (last == p_data[pos + pattern_len - 1]) &&
+            (0 == memcmp(p_data + pos, p_pattern, pattern_len)))
+        {
+            return p_data + pos;
+        }
+    }
+    return NULL;
+}
+
+#ifdef SEARCH_HAVE_X86
+// @brief first occurrence of p_pattern in p_data, 16 candidate positions at a time
+__attribute__((target("sse2")))
+static char const * find_sse2(char const * const p_data, const size_t len, char const * const p_pattern,
+                              const size_t pattern_len)
+{
+    if (len < pattern_len)
+    {
+        return NULL;
+    }
+
+    const __m128i first = _mm_set1_epi8(p_pattern[0]);
+    const __m128i last = _mm_set1_epi8(p_pattern[pattern_len - 1]);
+    // candidate positions are [0, candidates), the loads of the last byte of a
+    // block of candidates stay within len
+    const size_t candidates = len - pattern_len + 1;
+    size_t pos = 0;
+
+    for (; pos + sizeof(__m128i) <= candidates; pos += sizeof(__m128i))
+    {
+        __m128i block_first = _mm_loadu_si128((__m128i const *)(p_data + pos));
+        __m128i block_last = _mm_loadu_si128((__m128i const *)(p_data + pos + pattern_len - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                            _mm_cmpeq_epi8(last, block_last)));
+        while (0 != mask)
+        {
+            unsigned int bit = __builtin_ctz(mask);
+            if (0 == memcmp(p_data + pos + bit, p_pattern, pattern_len))
+            {
+                return p_data + pos + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar(p_data + pos, len - pos, p_pattern, pattern_len);
+}
+
+// @brief first occurrence of p_pattern in p_data, 32 candidate positions at a time
+__attribute__((target("avx2")))
+static char const * find_avx2(char const * const p_data, const size_t len, char const * const p_pattern,
+                              const size_t pattern_len)
+{
+    if (len < pattern_len)
+    {
+        return NULL;
+    }
+
+    const __m256i first = _mm256_set1_epi8(p_pattern[0]);
+    const __m256i last = _mm256_set1_epi8(p_pattern[pattern_len - 1]);
+    const size_t candidates = len - pattern_len + 1;
+    size_t pos = 0;
+
+    for (; pos + sizeof(__m256i) <= candidates; pos += sizeof(__m256i))
+    {
+        __m256i block_first = _mm256_loadu_si256((__m256i const *)(p_data + pos));
+        __m256i block_last = _mm256_loadu_si256((__m256i const *)(p_data + pos + pattern_len - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (0 != mask)
+        {
+            unsigned int bit = __builtin_ctz(mask);
+            if (0 == memcmp(p_data + pos + bit, p_pattern, pattern_len))
+            {
+                return p_data + pos + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_sse2(p_data + pos, len - pos, p_pattern, pattern_len);
+}
+#endif
+
+/**
+ * @return true if the cpu can run search variant @param impl
+ */
+bool search_impl_supported(const enum search_impl_e impl)
+{
+    switch (impl)
+    {
+        case SEARCH_IMPL_SCALAR:
+            return true;
+#ifdef SEARCH_HAVE_X86
+        case SEARCH_IMPL_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case SEARCH_IMPL_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+char const * search_impl_name(const enum search_impl_e impl)
+{
+    return (impl < SEARCH_IMPL_COUNT) ? impl_names[impl] : "unknown";
+}
+
+// @brief pick the fastest variant the cpu supports
+static void init_best_impl(void)
+{
+    for (int impl = SEARCH_IMPL_COUNT - 1; impl > SEARCH_IMPL_SCALAR; impl--)
+    {
+        if (search_impl_supported(impl))
+        {
+            best_impl = impl;
+            break;
+        }
+    }
+}
+
+/**
+ * First occurrence of @param p_pattern in @param p_data using variant @param impl,
+ * which must be supported by the cpu
+ * @return NULL if there is none, or @param pattern_len is 0
+ */
+char const * search_find_impl(const enum search_impl_e impl, char const * const p_data, const size_t len,
+                              char const * const p_pattern, const size_t pattern_len)
+{
+    if (0 == pattern_len)
+    {
+        return NULL;
+    }
+
+    switch (impl)
+    {
+#ifdef SEARCH_HAVE_X86
+        case SEARCH_IMPL_AVX2:
+            return find_avx2(p_data, len, p_pattern, pattern_len);
+        case SEARCH_IMPL_SSE2:
+            return find_sse2(p_data, len, p_pattern, pattern_len);
+#endif
+        default:
+            return find_scalar(p_data, len, p_pattern, pattern_len);
+    }
+}
+
+/**
+ * First occurrence of @param p_pattern in @param p_data, using the fastest
+ * variant the cpu supports
+ */
+char const * search_find(char const * const p_data, const size_t len, char const * const p_pattern,
+                         const size_t pattern_len)
+{
+    pthread_once(&best_impl_once, init_best_impl);
+    return search_find_impl(best_impl, p_data, len, p_pattern, pattern_len);
+}
+
+// @brief append the match [start, end) to p_result
+static bool add_match(struct search_result_s * const p_result, const uint64_t start, const uint64_t end)
+{
+    if (p_result->count == p_result->capacity)
+    {
+        size_t new_capacity = (0 == p_result->capacity) ? SEARCH_INIT_CAPACITY : 2 * p_result->capacity;
+        struct search_match_s * p_tmp = realloc(p_result->p_matches, new_capacity * sizeof(struct search_match_s));
+        if (NULL == p_tmp)
+        {
+            return false;
+        }
+        p_result->p_matches = p_tmp;
+        p_result->capacity = new_capacity;
+    }
+
+    p_result->p_matches[p_result->count].start = start;
+    p_result->p_matches[p_result->count].end = end;
+    p_result->count++;
+    p_result->bytes += end - start;
+    return true;
+}
+
+// @brief collect the records of p_segment containing its pattern. The scan
+// resumes after every matching record, so a record is reported once
+static void * search_segment(void * p_arg)
+{
+    struct segment_s * p_segment = (struct segment_s *)p_arg;
+    char const * const p_data = p_segment->p_data;
+    uint64_t pos = p_segment->start;
+
+    p_segment->b_status = true;
+    while (pos < p_segment->end)
+    {
+        char const * p_match = search_find(p_data + pos, p_segment->end - pos, p_segment->p_pattern,
+                                           p_segment->pattern_len);
+        if (NULL == p_match)
+        {
+            break;
+        }
+
+        // pos is always the start of a record, the pattern never spans a newline
+        char const * p_prev_newline = memrchr(p_data + pos, '\n', p_match - (p_data + pos));
+        uint64_t record_start = (NULL != p_prev_newline) ? (uint64_t)(p_prev_newline + 1 - p_data) : pos;
+        char const * p_newline = memchr(p_match, '\n', p_data + p_segment->end - p_match);
+        uint64_t record_end = (NULL != p_newline) ? (uint64_t)(p_newline + 1 - p_data) : p_segment->end;
+
+        if (!add_match(&p_segment->result, record_start, record_end))
+        {
+            p_segment->b_status = false;
+            break;
+        }
+        pos = record_end;
+    }
+
+    return NULL;
+}
+
+// @brief number of cpus the calling thread may run on, scanning threads inherit them
+static unsigned int allowed_cpus(void)
+{
+    cpu_set_t cpu_set;
+
+    if (0 != pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set))
+    {
+        return 1;
+    }
+    return CPU_COUNT(&cpu_set);
+}
+
+/**
+ * Collect the newline terminated records of @param p_data containing @param p_pattern,
+ * which must not contain a newline, into @param p_result. Logs of several
+ * SEARCH_SEGMENT_MIN_LEN are split into segments at record boundaries, scanned
+ * by up to @param max_threads threads including the caller, 0 for one per cpu
+ * the caller may run on.
+ * @return false if memory ran out, @param p_result then misses matches.
+ * @param p_result must be freed with search_result_destroy either way
+ */
+bool search_records(char const * const p_data, const size_t len, char const * const p_pattern,
+                    const size_t pattern_len, const unsigned int max_threads, struct search_result_s * const p_result)
+{
+    struct segment_s segments[SEARCH_MAX_THREADS];
+    bool b_status = true;
+
+    memset(p_result, 0, sizeof(*p_result));
+    if (0 == pattern_len)
+    {
+        return true;
+    }
+
+    size_t num_segments = (0 == max_threads) ? allowed_cpus() : max_threads;
+    if (num_segments > len / SEARCH_SEGMENT_MIN_LEN)
+    {
+        num_segments = len / SEARCH_SEGMENT_MIN_LEN;
+    }
+    if (num_segments > SEARCH_MAX_THREADS)
+    {
+        num_segments = SEARCH_MAX_THREADS;
+    }
+    if (0 == num_segments)
+    {
+        num_segments = 1;
+    }
+
+    // segments end after the first newline at or after their even share
+    uint64_t start = 0;
+    for (size_t idx = 0; idx < num_segments; idx++)
+    {
+        uint64_t end = len;
+        if (idx + 1 < num_segments)
+        {
+            uint64_t share_end = (uint64_t)len * (idx + 1) / num_segments;
+            char const * p_newline = (share_end > start) ? memchr(p_data + share_end, '\n', len - share_end) : NULL;
+            end = (NULL != p_newline) ? (uint64_t)(p_newline + 1 - p_data) : ((share_end > start) ? len : start);
+        }
+
+        segments[idx] = (struct segment_s){.p_data = p_data, .start = start, .end = end, .p_pattern = p_pattern,
+                                           .pattern_len = pattern_len};
+        start = end;
+    }
+
+    for (size_t idx = 1; idx < num_segments; idx++)
+    {
+        if (segments[idx].start == segments[idx].end)
+        {
+            continue;
+        }
+        if (0 == pthread_create(&segments[idx].tid, NULL, search_segment, &segments[idx]))
+        {
+            segments[idx].b_thread_started = true;
+        }
+        else
+        {
+            // scan it on the calling thread instead
+            search_segment(&segments[idx]);
+        }
+    }
+    search_segment(&segments[0]);
+
+    // results are merged in segment order, so matches stay oldest first
+    for (size_t idx = 0; idx < num_segments; idx++)
+    {
+        struct segment_s * p_segment = &segments[idx];
+
+        if (p_segment->b_thread_started)
+        {
+            pthread_join(p_segment->tid, NULL);
+        }
+        if (p_segment->start == p_segment->end)
+        {
+            continue;
+        }
+
+        b_status = b_status && p_segment->b_status;
+        if (0 == idx)
+        {
+            *p_result = p_segment->result;
+            continue;
+        }
+        for (size_t match = 0; b_status && (match < p_segment->result.count); match++)
+        {
+            b_status = add_match(p_result, p_segment->result.p_matches[match].start,
+                                 p_segment->result.p_matches[match].end);
+        }
+        search_result_destroy(&p_segment->result);
+    }
+
+    return b_status;
+}
+
+void search_result_destroy(struct search_result_s * const p_result)
+{
+    free(p_result->p_matches);
+    memset(p_result, 0, sizeof(*p_result));
+}
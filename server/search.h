@@ -0,0 +1,64 @@
+/*
+ * @file search.h
+ * @author krish shah
+ * @brief substring search over aesdsocket records. Candidates are found by
+ * comparing the first and last byte of the pattern at 32 (AVX2) or 16 (SSE2)
+ * positions at once, only those are compared in full. The fastest variant the
+ * cpu supports is picked on first use, with a scalar fallback. Large logs are
+ * split into segments at record boundaries and scanned in parallel
+ */
+#ifndef AESDSOCKET_SEARCH_H
+#define AESDSOCKET_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum search_impl_e
+{
+    SEARCH_IMPL_SCALAR,
+    SEARCH_IMPL_SSE2,
+    SEARCH_IMPL_AVX2,
+    SEARCH_IMPL_COUNT
+};
+
+/**
+ * byte range [start, end) of a record containing the pattern
+ */
+struct search_match_s
+{
+    uint64_t start;
+    uint64_t end;
+};
+
+struct search_result_s
+{
+    /**
+     * matching records, oldest first
+     */
+    struct search_match_s * p_matches;
+    size_t count;
+    size_t capacity;
+    /**
+     * sum of the lengths of all matching records
+     */
+    size_t bytes;
+};
+
+extern bool search_impl_supported(const enum search_impl_e impl);
+
+extern char const * search_impl_name(const enum search_impl_e impl);
+
+extern char const * search_find_impl(const enum search_impl_e impl, char const * const p_data, const size_t len,
+                                     char const * const p_pattern, const size_t pattern_len);
+
+extern char const * search_find(char const * const p_data, const size_t len, char const * const p_pattern,
+                                const size_t pattern_len);
+
+extern bool search_records(char const * const p_data, const size_t len, char const * const p_pattern,
+                           const size_t pattern_len, const unsigned int max_threads,
+                           struct search_result_s * const p_result);
+
+extern void search_result_destroy(struct search_result_s * const p_result);
+
+#endif /* AESDSOCKET_SEARCH_H */
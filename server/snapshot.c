@@ -0,0 +1,143 @@
+/*
+ * @file snapshot.c
+ * @author krish shah
+ * @brief in memory copy of the aesdsocket data file, shared by concurrent
+ * writebacks. Appends copy only the new bytes, behind the ones readers may be
+ * sending. Only when the buffer is full are its bytes copied into one of twice
+ * the size, the old buffer lives on till its last reader puts it.
+ * The cache itself is protected by the storage mutex, snapshots may be sent
+ * and put without holding it.
+ */
+#include "snapshot.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#define SNAPSHOT_INIT_CAPACITY (64UL << 10)
+
+struct snapshot_buf_s
+{
+    unsigned long refcount;
+    size_t capacity;
+    char data[];
+};
+
+// @brief new buffer with one reference, held by the cache
+static struct snapshot_buf_s * snapshot_buf_alloc(const size_t capacity)
+{
+    struct snapshot_buf_s * p_buf = malloc(sizeof(struct snapshot_buf_s) + capacity);
+    if (NULL != p_buf)
+    {
+        p_buf->refcount = 1;
+        p_buf->capacity = capacity;
+    }
+    return p_buf;
+}
+
+// @brief drop one reference to p_buf, freeing it with the last one
+static void snapshot_buf_put(struct snapshot_buf_s * const p_buf)
+{
+    if ((NULL != p_buf) && (1 == __atomic_fetch_sub(&p_buf->refcount, 1, __ATOMIC_ACQ_REL)))
+    {
+        free(p_buf);
+    }
+}
+
+// @brief stop caching, writebacks fall back to reading storage
+static void snapshot_cache_disable(struct snapshot_cache_s * const p_cache)
+{
+    snapshot_buf_put(p_cache->p_buf);
+    p_cache->p_buf = NULL;
+    p_cache->len = 0;
+}
+
+/**
+ * Initialize @param p_cache for an empty log
+ * @return false if the initial buffer could not be allocated, the cache is then disabled
+ */
+bool snapshot_cache_init(struct snapshot_cache_s * const p_cache)
+{
+    p_cache->p_buf = snapshot_buf_alloc(SNAPSHOT_INIT_CAPACITY);
+    p_cache->len = 0;
+    return NULL != p_cache->p_buf;
+}
+
+void snapshot_cache_destroy(struct snapshot_cache_s * const p_cache)
+{
+    snapshot_cache_disable(p_cache);
+}
+
+/**
+ * Add @param len bytes at @param p_data, just appended to the log, to the
+ * current version. Disables the cache if the log outgrows SNAPSHOT_CACHE_MAX_SIZE
+ * or memory runs out, the log would be incomplete from then on.
+ */
+void snapshot_cache_append(struct snapshot_cache_s * const p_cache, char const * const p_data, const size_t len)
+{
+    if (NULL == p_cache->p_buf)
+    {
+        return;
+    }
+
+    size_t required = p_cache->len + len;
+    if (required > p_cache->p_buf->capacity)
+    {
+        size_t new_capacity = 2 * p_cache->p_buf->capacity;
+        while (new_capacity < required)
+        {
+            new_capacity *= 2;
+        }
+
+        struct snapshot_buf_s * p_new_buf = NULL;
+        if (required <= SNAPSHOT_CACHE_MAX_SIZE)
+        {
+            p_new_buf = snapshot_buf_alloc(new_capacity);
+        }
+        if (NULL == p_new_buf)
+        {
+            syslog(LOG_INFO, "log of %zu bytes is not cached any more", required);
+            snapshot_cache_disable(p_cache);
+            return;
+        }
+
+        // snapshots of the old version keep the old buffer alive
+        memcpy(p_new_buf->data, p_cache->p_buf->data, p_cache->len);
+        snapshot_buf_put(p_cache->p_buf);
+        p_cache->p_buf = p_new_buf;
+        stats_add(STAT_SNAPSHOT_REBUILDS, 1);
+    }
+
+    // readers only ever look below their own length, these bytes are theirs to ignore
+    memcpy(p_cache->p_buf->data + p_cache->len, p_data, len);
+    p_cache->len = required;
+}
+
+/**
+ * Take a reference on the current version of the log
+ * @return false if the cache is disabled, storage has to be read instead
+ */
+bool snapshot_cache_get(struct snapshot_cache_s const * const p_cache, struct snapshot_s * const p_snapshot)
+{
+    if (NULL == p_cache->p_buf)
+    {
+        return false;
+    }
+
+    __atomic_fetch_add(&p_cache->p_buf->refcount, 1, __ATOMIC_RELAXED);
+    p_snapshot->p_buf = p_cache->p_buf;
+    p_snapshot->p_data = p_cache->p_buf->data;
+    p_snapshot->len = p_cache->len;
+    return true;
+}
+
+/**
+ * Drop the reference of @param p_snapshot, callable without the storage mutex
+ */
+void snapshot_put(struct snapshot_s * const p_snapshot)
+{
+    snapshot_buf_put(p_snapshot->p_buf);
+    p_snapshot->p_buf = NULL;
+    p_snapshot->p_data = NULL;
+    p_snapshot->len = 0;
+}
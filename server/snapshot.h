@@ -0,0 +1,51 @@
+/*
+ * @file snapshot.h
+ * @author krish shah
+ * @brief in memory copy of the aesdsocket data file, shared by concurrent
+ * writebacks. The log only grows, so a snapshot of one version is a length
+ * into a refcounted buffer whose bytes below that length never change
+ */
+#ifndef AESDSOCKET_SNAPSHOT_H
+#define AESDSOCKET_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * the cache gives up, and writebacks read storage again, once the log
+ * outgrows this many bytes
+ */
+#define SNAPSHOT_CACHE_MAX_SIZE (64UL << 20)
+
+struct snapshot_buf_s;
+
+/**
+ * Current log version, protected by the storage mutex
+ */
+struct snapshot_cache_s
+{
+    struct snapshot_buf_s * p_buf; // NULL once the cache gave up
+    size_t len;
+};
+
+/**
+ * One version of the log, held by a writeback, valid till snapshot_put
+ */
+struct snapshot_s
+{
+    struct snapshot_buf_s * p_buf;
+    char const * p_data;
+    size_t len;
+};
+
+extern bool snapshot_cache_init(struct snapshot_cache_s * const p_cache);
+
+extern void snapshot_cache_destroy(struct snapshot_cache_s * const p_cache);
+
+extern void snapshot_cache_append(struct snapshot_cache_s * const p_cache, char const * const p_data, const size_t len);
+
+extern bool snapshot_cache_get(struct snapshot_cache_s const * const p_cache, struct snapshot_s * const p_snapshot);
+
+extern void snapshot_put(struct snapshot_s * const p_snapshot);
+
+#endif /* AESDSOCKET_SNAPSHOT_H */
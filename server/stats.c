@@ -0,0 +1,235 @@
+/*
+ * @file stats.c
+ * @author krish shah
+ * @brief counters kept by aesdsocket. Every thread counts into a block of its
+ * own, with plain stores instead of atomic read-modify-writes on shared cache
+ * lines. stats_log sums the blocks of the running threads, the counts of
+ * finished threads are kept per numa node in separate cache lines
+ */
+#include "stats.h"
+#include "placement.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/queue.h>
+
+#define CACHE_LINE_SIZE 64
+
+struct node_stats_s
+{
+    unsigned long counters[NODE_STAT_COUNT];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// counters of one thread, written by that thread only
+struct thread_stats_s
+{
+    LIST_ENTRY(thread_stats_s) entries;
+    // node the node counters are for, changed under thread_stats_lock
+    int node;
+    unsigned long node_counters[NODE_STAT_COUNT];
+    unsigned long server_counters[STAT_COUNT];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+LIST_HEAD(thread_stats_list_s, thread_stats_s);
+
+static struct node_stats_s node_stats[PLACEMENT_MAX_NODES];
+static unsigned long server_stats[STAT_COUNT];
+
+static struct thread_stats_list_s thread_stats_list = LIST_HEAD_INITIALIZER(thread_stats_list);
+static pthread_mutex_t thread_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_stats_key;
+static pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+static __thread struct thread_stats_s * p_thread_stats;
+
+static char const * const server_stat_names[STAT_COUNT] = {
+    [STAT_STORAGE_READS] = "storage_reads",
+    [STAT_SNAPSHOT_WRITEBACKS] = "snapshot_writebacks",
+    [STAT_SNAPSHOT_REBUILDS] = "snapshot_rebuilds",
+};
+
+static char const * const node_stat_names[NODE_STAT_COUNT] = {
+    [NODE_STAT_CONNECTIONS] = "connections",
+    [NODE_STAT_BYTES_RECEIVED] = "bytes_received",
+    [NODE_STAT_RECORDS_COMMITTED] = "records_committed",
+    [NODE_STAT_BYTES_WRITTEN_BACK] = "bytes_written_back",
+    [NODE_STAT_READ_COMMANDS] = "read_commands",
+    [NODE_STAT_OUTQ_OVERFLOWS] = "outq_overflows",
+    [NODE_STAT_SLOW_CONSUMER_DISCONNECTS] = "slow_consumer_disconnects",
+    [NODE_STAT_POOL_MALLOCS] = "pool_mallocs",
+    [NODE_STAT_POOL_REUSES] = "pool_reuses",
+};
+
+// @brief add value to a counter only the calling thread writes, readers may
+// load it any time
+static void thread_counter_add(unsigned long * const p_counter, const unsigned long value)
+{
+    __atomic_store_n(p_counter, __atomic_load_n(p_counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// @brief move the counters of p_stats to the shared counters, the caller holds
+// thread_stats_lock and is the thread owning p_stats
+static void retire_thread_stats(struct thread_stats_s * const p_stats)
+{
+    for (int stat = 0; stat < NODE_STAT_COUNT; stat++)
+    {
+        __atomic_fetch_add(&node_stats[p_stats->node].counters[stat], p_stats->node_counters[stat], __ATOMIC_RELAXED);
+        __atomic_store_n(&p_stats->node_counters[stat], 0, __ATOMIC_RELAXED);
+    }
+    for (int stat = 0; stat < STAT_COUNT; stat++)
+    {
+        __atomic_fetch_add(&server_stats[stat], p_stats->server_counters[stat], __ATOMIC_RELAXED);
+        __atomic_store_n(&p_stats->server_counters[stat], 0, __ATOMIC_RELAXED);
+    }
+}
+
+// @brief thread specific data destructor, keeps the counts of a finished thread
+static void destroy_thread_stats(void * p_arg)
+{
+    struct thread_stats_s * p_stats = (struct thread_stats_s *)p_arg;
+
+    p_thread_stats = NULL;
+    pthread_mutex_lock(&thread_stats_lock);
+    retire_thread_stats(p_stats);
+    LIST_REMOVE(p_stats, entries);
+    pthread_mutex_unlock(&thread_stats_lock);
+    free(p_stats);
+}
+
+static void init_thread_stats_key(void)
+{
+    if (0 != pthread_key_create(&thread_stats_key, destroy_thread_stats))
+    {
+        syslog(LOG_ERR, "could not create thread stats key");
+    }
+}
+
+// @brief counters of the calling thread, registered on first use,
+// NULL if they could not be allocated
+static struct thread_stats_s * get_thread_stats(void)
+{
+    if (NULL != p_thread_stats)
+    {
+        return p_thread_stats;
+    }
+
+    pthread_once(&thread_stats_once, init_thread_stats_key);
+    struct thread_stats_s * p_stats = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct thread_stats_s));
+    if (NULL == p_stats)
+    {
+        return NULL;
+    }
+    memset(p_stats, 0, sizeof(*p_stats));
+
+    pthread_mutex_lock(&thread_stats_lock);
+    LIST_INSERT_HEAD(&thread_stats_list, p_stats, entries);
+    pthread_mutex_unlock(&thread_stats_lock);
+    pthread_setspecific(thread_stats_key, p_stats);
+
+    p_thread_stats = p_stats;
+    return p_stats;
+}
+
+/**
+ * Add @param value to server wide counter @param stat, safe to call from any thread
+ */
+void stats_add(const enum server_stat_e stat, const unsigned long value)
+{
+    struct thread_stats_s * p_stats = get_thread_stats();
+
+    if (NULL == p_stats)
+    {
+        __atomic_fetch_add(&server_stats[stat], value, __ATOMIC_RELAXED);
+        return;
+    }
+    thread_counter_add(&p_stats->server_counters[stat], value);
+}
+
+/**
+ * Add @param value to counter @param stat of numa node @param node, safe to call
+ * from any thread
+ */
+void stats_node_add(const int node, const enum node_stat_e stat, const unsigned long value)
+{
+    // nodes out of range are still counted, with the last node
+    int idx = ((node >= 0) && (node < PLACEMENT_MAX_NODES)) ? node : PLACEMENT_MAX_NODES - 1;
+    struct thread_stats_s * p_stats = get_thread_stats();
+
+    if (NULL == p_stats)
+    {
+        __atomic_fetch_add(&node_stats[idx].counters[stat], value, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // a thread counts for one node at a time, what it counted for the previous
+    // one is handed over when it moves
+    if (p_stats->node != idx)
+    {
+        pthread_mutex_lock(&thread_stats_lock);
+        retire_thread_stats(p_stats);
+        p_stats->node = idx;
+        pthread_mutex_unlock(&thread_stats_lock);
+    }
+    thread_counter_add(&p_stats->node_counters[stat], value);
+}
+
+/**
+ * Log the server wide counters, and every counter of every node that counted anything
+ */
+void stats_log(void)
+{
+    unsigned long server_totals[STAT_COUNT];
+    static struct node_stats_s node_totals[PLACEMENT_MAX_NODES];
+    struct thread_stats_s * p_stats;
+
+    // node_totals is static for its size, stats_log runs on the main thread only
+    pthread_mutex_lock(&thread_stats_lock);
+    for (int stat = 0; stat < STAT_COUNT; stat++)
+    {
+        server_totals[stat] = __atomic_load_n(&server_stats[stat], __ATOMIC_RELAXED);
+    }
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+    {
+        for (int stat = 0; stat < NODE_STAT_COUNT; stat++)
+        {
+            node_totals[node].counters[stat] = __atomic_load_n(&node_stats[node].counters[stat], __ATOMIC_RELAXED);
+        }
+    }
+    LIST_FOREACH(p_stats, &thread_stats_list, entries)
+    {
+        for (int stat = 0; stat < STAT_COUNT; stat++)
+        {
+            server_totals[stat] += __atomic_load_n(&p_stats->server_counters[stat], __ATOMIC_RELAXED);
+        }
+        for (int stat = 0; stat < NODE_STAT_COUNT; stat++)
+        {
+            node_totals[p_stats->node].counters[stat] +=
+                __atomic_load_n(&p_stats->node_counters[stat], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&thread_stats_lock);
+
+    for (int stat = 0; stat < STAT_COUNT; stat++)
+    {
+        syslog(LOG_INFO, "stats %s=%lu", server_stat_names[stat], server_totals[stat]);
+    }
+
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+    {
+        bool b_used = false;
+        for (int stat = 0; stat < NODE_STAT_COUNT; stat++)
+        {
+            b_used = b_used || (0 != node_totals[node].counters[stat]);
+        }
+        if (!b_used)
+        {
+            continue;
+        }
+
+        for (int stat = 0; stat < NODE_STAT_COUNT; stat++)
+        {
+            syslog(LOG_INFO, "stats node %d %s=%lu", node, node_stat_names[stat], node_totals[node].counters[stat]);
+        }
+    }
+}
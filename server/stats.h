@@ -0,0 +1,37 @@
+/*
+ * @file stats.h
+ * @author krish shah
+ * @brief counters kept by aesdsocket, reported to syslog on SIGUSR1 and on exit
+ */
+#ifndef AESDSOCKET_STATS_H
+#define AESDSOCKET_STATS_H
+
+enum node_stat_e
+{
+    NODE_STAT_CONNECTIONS,
+    NODE_STAT_BYTES_RECEIVED,
+    NODE_STAT_RECORDS_COMMITTED,
+    NODE_STAT_BYTES_WRITTEN_BACK,
+    NODE_STAT_READ_COMMANDS,
+    NODE_STAT_OUTQ_OVERFLOWS,
+    NODE_STAT_SLOW_CONSUMER_DISCONNECTS,
+    NODE_STAT_POOL_MALLOCS,
+    NODE_STAT_POOL_REUSES,
+    NODE_STAT_COUNT
+};
+
+enum server_stat_e
+{
+    STAT_STORAGE_READS,
+    STAT_SNAPSHOT_WRITEBACKS,
+    STAT_SNAPSHOT_REBUILDS,
+    STAT_COUNT
+};
+
+extern void stats_add(const enum server_stat_e stat, const unsigned long value);
+
+extern void stats_node_add(const int node, const enum node_stat_e stat, const unsigned long value);
+
+extern void stats_log(void);
+
+#endif /* AESDSOCKET_STATS_H */
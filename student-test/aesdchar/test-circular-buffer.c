@@ -0,0 +1,107 @@
+/*
+ * @file test-circular-buffer.c
+ * @brief boundaries of the aesdchar circular buffer copy out loop, built for
+ * userspace: empty buffer, reads spanning entries, reads at and past the end,
+ * a ring wrapped past its last slot and eviction by byte budget
+ */
+#include <string.h>
+#include "../test-check.h"
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+// @brief add the null terminated string p_str as an entry of p_buffer
+static void add(struct aesd_circular_buffer * const p_buffer, char const * const p_str)
+{
+    struct aesd_buffer_entry entry = {.buffptr = p_str, .size = strlen(p_str)};
+    aesd_circular_buffer_add_entry(p_buffer, &entry);
+}
+
+// @brief true if copying count bytes at char_offset of p_buffer returns exactly p_expected
+static bool copies(struct aesd_circular_buffer * const p_buffer, const size_t char_offset, const size_t count,
+                   char const * const p_expected)
+{
+    char out[64];
+    memset(out, 0, sizeof(out));
+    ssize_t copied = aesd_circular_buffer_copy_out(p_buffer, char_offset, out, count);
+    return (copied == (ssize_t)strlen(p_expected)) && (0 == memcmp(out, p_expected, copied));
+}
+
+static void test_empty(void)
+{
+    struct aesd_circular_buffer buffer;
+    size_t entry_offset = 0;
+
+    aesd_circular_buffer_init(&buffer);
+    CHECK(NULL == aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry_offset));
+    CHECK(copies(&buffer, 0, 10, ""));
+    CHECK(copies(&buffer, 5, 10, ""));
+}
+
+static void test_spanning(void)
+{
+    struct aesd_circular_buffer buffer;
+
+    aesd_circular_buffer_init(&buffer);
+    add(&buffer, "ab");
+    add(&buffer, "cde");
+    add(&buffer, "f");
+
+    CHECK(copies(&buffer, 0, 6, "abcdef"));
+    CHECK(copies(&buffer, 1, 3, "bcd"));
+    CHECK(copies(&buffer, 2, 3, "cde"));
+    CHECK(copies(&buffer, 0, 0, ""));
+    // reads past the end are cut at the newest byte
+    CHECK(copies(&buffer, 4, 60, "ef"));
+    CHECK(copies(&buffer, 5, 1, "f"));
+    CHECK(copies(&buffer, 6, 1, ""));
+    CHECK(copies(&buffer, (size_t)-1, 1, ""));
+}
+
+static void test_wrapped(void)
+{
+    struct aesd_circular_buffer buffer;
+    static char const * const entries[] = {"e0", "e1", "e2", "e3", "e4", "e5", "e6"};
+
+    // 4 slots, the last 4 of 7 entries are kept in slots 3, 0, 1 and 2
+    CHECK(0 == aesd_circular_buffer_init_capacity(&buffer, 4, 0));
+    for (size_t idx = 0; idx < sizeof(entries) / sizeof(entries[0]); idx++)
+    {
+        add(&buffer, entries[idx]);
+    }
+    CHECK(4 == buffer.count);
+    CHECK(3 == buffer.out_offs);
+    CHECK(8 == buffer.total_size);
+
+    CHECK(copies(&buffer, 0, 8, "e3e4e5e6"));
+    CHECK(copies(&buffer, 1, 2, "3e"));
+    CHECK(copies(&buffer, 3, 5, "4e5e6"));
+    CHECK(copies(&buffer, 7, 8, "6"));
+    CHECK(copies(&buffer, 8, 8, ""));
+    CHECK(2 == aesd_circular_buffer_entry_char_offset(&buffer, 1));
+    aesd_circular_buffer_destroy(&buffer);
+}
+
+static void test_byte_budget(void)
+{
+    struct aesd_circular_buffer buffer;
+
+    CHECK(0 == aesd_circular_buffer_init_capacity(&buffer, 8, 5));
+    add(&buffer, "abc");
+    add(&buffer, "de");
+    add(&buffer, "fg");
+    CHECK(2 == buffer.count);
+    CHECK(copies(&buffer, 0, 10, "defg"));
+    // an entry over the budget on its own evicts everything else
+    add(&buffer, "hijklm");
+    CHECK(1 == buffer.count);
+    CHECK(copies(&buffer, 0, 10, "hijklm"));
+    aesd_circular_buffer_destroy(&buffer);
+}
+
+int main(void)
+{
+    test_empty();
+    test_spanning();
+    test_wrapped();
+    test_byte_budget();
+    return CHECK_DONE();
+}
@@ -0,0 +1,177 @@
+/*
+ * @file test-outq.c
+ * @brief boundaries of the aesdsocket output queue: watermark arguments,
+ * pausing just over the high watermark and resuming at the low one, partial
+ * sends to a full socket, and slow consumer detection by send progress
+ */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../test-check.h"
+#include "../../server/outq.h"
+#include "../../server/buf_pool.h"
+
+#define SEG_LEN 4096
+
+// @brief queue SEG_LEN bytes of c in a buf_pool block
+static void push(struct outq_s * const p_outq, const char c)
+{
+    size_t capacity;
+    char * p_block = buf_pool_alloc(SEG_LEN, &capacity);
+    CHECK(NULL != p_block);
+    if (NULL != p_block)
+    {
+        memset(p_block, c, SEG_LEN);
+        CHECK(outq_push_block(p_outq, p_block, capacity, 0, SEG_LEN));
+    }
+}
+
+// @brief read whatever h_sockfd holds without blocking, return the bytes read
+static size_t drain(const int h_sockfd)
+{
+    char buf[SEG_LEN];
+    size_t total = 0;
+    ssize_t len;
+
+    while ((len = recv(h_sockfd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        total += len;
+    }
+    return total;
+}
+
+static void test_config(void)
+{
+    struct outq_config_s config;
+
+    outq_config_init(&config);
+    CHECK(!outq_config_parse(&config, "0"));
+    CHECK(!outq_config_parse(&config, "x"));
+    CHECK(!outq_config_parse(&config, "100,200"));
+    CHECK(!outq_config_parse(&config, "100,"));
+    CHECK(!outq_config_parse(&config, "100,10,"));
+    CHECK(outq_config_parse(&config, "100") && (100 == config.high_watermark) && (25 == config.low_watermark));
+    CHECK(outq_config_parse(&config, "100,100,7") && (100 == config.low_watermark) &&
+          (7 == config.slow_consumer_timeout_ms));
+}
+
+static void test_watermarks(void)
+{
+    struct outq_s outq;
+    struct outq_config_s config = {.high_watermark = 2 * SEG_LEN, .low_watermark = SEG_LEN};
+    bool b_paused_now;
+
+    outq_init(&outq);
+    push(&outq, 'a');
+    push(&outq, 'b');
+    // at the high watermark is not over it
+    CHECK(!outq_update_backpressure(&outq, &config, &b_paused_now) && !b_paused_now);
+    push(&outq, 'c');
+    CHECK(outq_update_backpressure(&outq, &config, &b_paused_now) && b_paused_now);
+    CHECK(outq_update_backpressure(&outq, &config, &b_paused_now) && !b_paused_now);
+
+    // pretend the client read down to just over the low watermark, then to it
+    outq.queued_bytes = SEG_LEN + 1;
+    CHECK(outq_update_backpressure(&outq, &config, &b_paused_now));
+    outq.queued_bytes = SEG_LEN;
+    CHECK(!outq_update_backpressure(&outq, &config, &b_paused_now));
+    outq.queued_bytes = 3 * SEG_LEN;
+    outq_destroy(&outq);
+    CHECK(0 == outq.queued_bytes);
+}
+
+static void test_flush(void)
+{
+    struct outq_s outq;
+    int h_sockfds[2];
+    int sndbuf = SEG_LEN;
+    size_t sent = 0;
+    size_t received = 0;
+
+    CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, h_sockfds));
+    setsockopt(h_sockfds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    outq_init(&outq);
+    for (int idx = 0; idx < 64; idx++)
+    {
+        push(&outq, 'a' + (idx % 26));
+    }
+
+    // the socket takes only part of the queue, what is left stays queued
+    CHECK(outq_flush(&outq, h_sockfds[0], &sent));
+    CHECK((sent > 0) && (sent < 64 * SEG_LEN));
+    CHECK(sent + outq.queued_bytes == 64 * SEG_LEN);
+
+    for (int round = 0; (round < 1000) && (outq.queued_bytes > 0); round++)
+    {
+        received += drain(h_sockfds[1]);
+        CHECK(outq_flush(&outq, h_sockfds[0], &sent));
+    }
+    received += drain(h_sockfds[1]);
+    CHECK(0 == outq.queued_bytes);
+    CHECK(64 * SEG_LEN == sent);
+    CHECK(64 * SEG_LEN == received);
+
+    // a closed peer fails the flush
+    push(&outq, 'z');
+    close(h_sockfds[1]);
+    CHECK(!outq_flush(&outq, h_sockfds[0], &sent));
+    outq_destroy(&outq);
+    close(h_sockfds[0]);
+}
+
+static void test_slow_consumer(void)
+{
+    struct outq_s outq;
+    struct outq_config_s config = {.high_watermark = SEG_LEN, .low_watermark = 0, .slow_consumer_timeout_ms = 50};
+    int h_sockfds[2];
+    int sndbuf = SEG_LEN;
+    int timeout_ms;
+    bool b_paused_now;
+    size_t sent = 0;
+
+    CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, h_sockfds));
+    setsockopt(h_sockfds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    outq_init(&outq);
+    for (int idx = 0; idx < 64; idx++)
+    {
+        push(&outq, 'a');
+    }
+    CHECK(outq_update_backpressure(&outq, &config, &b_paused_now));
+    CHECK(!outq_is_slow_consumer(&outq, &config, &timeout_ms) && (timeout_ms > 0) && (timeout_ms <= 50));
+
+    // a client reading its queue is never slow, however long it stays over high
+    for (int round = 0; round < 4; round++)
+    {
+        usleep(30 * 1000);
+        drain(h_sockfds[1]);
+        CHECK(outq_flush(&outq, h_sockfds[0], &sent));
+        CHECK(!outq_is_slow_consumer(&outq, &config, &timeout_ms));
+    }
+    CHECK(outq.b_paused);
+
+    // once it stops reading it is
+    CHECK(outq_flush(&outq, h_sockfds[0], &sent));
+    usleep(60 * 1000);
+    CHECK(outq_flush(&outq, h_sockfds[0], &sent));
+    CHECK(outq_is_slow_consumer(&outq, &config, &timeout_ms));
+
+    // without a timeout nobody is
+    config.slow_consumer_timeout_ms = 0;
+    CHECK(!outq_is_slow_consumer(&outq, &config, &timeout_ms) && (-1 == timeout_ms));
+
+    outq_destroy(&outq);
+    close(h_sockfds[0]);
+    close(h_sockfds[1]);
+}
+
+int main(void)
+{
+    test_config();
+    test_watermarks();
+    test_flush();
+    test_slow_consumer();
+    return CHECK_DONE();
+}
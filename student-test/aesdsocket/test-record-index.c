@@ -0,0 +1,78 @@
+/*
+ * @file test-record-index.c
+ * @brief boundaries of the aesdsocket record index: empty index, ranges at and
+ * past the newest record, including last == SIZE_MAX, tails and partial records
+ */
+#include <stdint.h>
+#include <string.h>
+#include "../test-check.h"
+#include "../../server/record_index.h"
+
+// @brief append p_data to p_index with a commit time of commit_ns
+static void append(struct record_index_s * const p_index, char const * const p_data, const uint64_t commit_ns)
+{
+    struct record_meta_s meta = {.commit_ns = commit_ns};
+    CHECK(record_index_append(p_index, p_data, strlen(p_data), &meta));
+}
+
+static void test_empty(void)
+{
+    struct record_index_s index;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
+    record_index_init(&index);
+    CHECK(!record_index_range(&index, 0, 0, &start, &end));
+    CHECK(!record_index_range(&index, 0, SIZE_MAX, &start, &end));
+    CHECK(!record_index_tail(&index, 1, &start, &end));
+    CHECK(!record_index_from(&index, 0, &start, &end));
+    CHECK(!record_index_time_range(&index, 0, UINT64_MAX, &start, &end));
+    record_index_destroy(&index);
+}
+
+static void test_range(void)
+{
+    struct record_index_s index;
+    uint64_t start = 0;
+    uint64_t end = 0;
+
+    record_index_init(&index);
+    // records at [0, 4), [4, 8) and [8, 14), then a partial one
+    append(&index, "one\ntw", 10);
+    append(&index, "o\nthree\npart", 20);
+    CHECK(3 == index.count);
+    CHECK(14 == index.end_offset);
+    CHECK(18 == index.size);
+
+    CHECK(record_index_range(&index, 0, 0, &start, &end) && (0 == start) && (4 == end));
+    CHECK(record_index_range(&index, 1, 2, &start, &end) && (4 == start) && (14 == end));
+    // the newest record, and last past it, end at the last complete record
+    CHECK(record_index_range(&index, 2, 2, &start, &end) && (8 == start) && (14 == end));
+    CHECK(record_index_range(&index, 1, 3, &start, &end) && (4 == start) && (14 == end));
+    CHECK(record_index_range(&index, 0, SIZE_MAX - 1, &start, &end) && (0 == start) && (14 == end));
+    CHECK(record_index_range(&index, 1, SIZE_MAX, &start, &end) && (4 == start) && (14 == end));
+    CHECK(record_index_range(&index, 2, SIZE_MAX, &start, &end) && (8 == start) && (14 == end));
+    CHECK(!record_index_range(&index, 3, SIZE_MAX, &start, &end));
+    CHECK(!record_index_range(&index, SIZE_MAX, SIZE_MAX, &start, &end));
+    CHECK(!record_index_range(&index, 2, 1, &start, &end));
+
+    CHECK(record_index_tail(&index, 1, &start, &end) && (8 == start) && (14 == end));
+    CHECK(record_index_tail(&index, SIZE_MAX, &start, &end) && (0 == start) && (14 == end));
+    CHECK(!record_index_tail(&index, 0, &start, &end));
+
+    CHECK(record_index_from(&index, 13, &start, &end) && (13 == start) && (14 == end));
+    CHECK(!record_index_from(&index, 14, &start, &end));
+
+    // a record is committed by the append completing it, the first at 10, the others at 20
+    CHECK(record_index_time_range(&index, 20, UINT64_MAX, &start, &end) && (4 == start) && (14 == end));
+    CHECK(record_index_time_range(&index, 0, 10, &start, &end) && (0 == start) && (4 == end));
+    CHECK(!record_index_time_range(&index, 21, UINT64_MAX, &start, &end));
+    record_index_destroy(&index);
+}
+
+int main(void)
+{
+    test_empty();
+    test_range();
+    return CHECK_DONE();
+}
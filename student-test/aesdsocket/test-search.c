@@ -0,0 +1,139 @@
+/*
+ * @file test-search.c
+ * @brief boundaries of the AESD_SEARCH scan: matches at every position around
+ * the 16 and 32 byte blocks of each implementation, at the end of the data,
+ * and records straddling the split between two parallel segments
+ */
+#include <stdint.h>
+#include <string.h>
+#include "../test-check.h"
+#include "../../server/search.h"
+
+#define BLOCK_DATA_LEN 100
+// two segments of at least the 4 MiB search.c splits logs into
+#define SEGMENTED_DATA_LEN ((9UL << 20) + 3)
+
+static void test_find_positions(void)
+{
+    char data[BLOCK_DATA_LEN];
+    static char const pattern[] = "xyz";
+    const size_t pattern_len = sizeof(pattern) - 1;
+
+    for (int impl = 0; impl < SEARCH_IMPL_COUNT; impl++)
+    {
+        if (!search_impl_supported(impl))
+        {
+            continue;
+        }
+
+        memset(data, 'a', sizeof(data));
+        CHECK(NULL == search_find_impl(impl, data, sizeof(data), pattern, pattern_len));
+        CHECK(NULL == search_find_impl(impl, data, 0, pattern, pattern_len));
+        CHECK(NULL == search_find_impl(impl, pattern, pattern_len - 1, pattern, pattern_len));
+
+        for (size_t pos = 0; pos + pattern_len <= sizeof(data); pos++)
+        {
+            memset(data, 'a', sizeof(data));
+            memcpy(data + pos, pattern, pattern_len);
+            char const * p_found = search_find_impl(impl, data, sizeof(data), pattern, pattern_len);
+            if (p_found != data + pos)
+            {
+                printf("%s: pattern at %zu not found there\n", search_impl_name(impl), pos);
+            }
+            CHECK(p_found == data + pos);
+            // cut one byte short the pattern must not be found
+            CHECK(NULL == search_find_impl(impl, data, pos + pattern_len - 1, pattern, pattern_len));
+        }
+
+        // first and last byte match without the middle one
+        memset(data, 'a', sizeof(data));
+        memcpy(data + 40, "xaz", 3);
+        CHECK(NULL == search_find_impl(impl, data, sizeof(data), pattern, pattern_len));
+        // a one byte pattern
+        data[sizeof(data) - 1] = 'q';
+        CHECK(data + sizeof(data) - 1 == search_find_impl(impl, data, sizeof(data), "q", 1));
+    }
+}
+
+static void test_records(void)
+{
+    struct search_result_s result;
+    static char const log[] = "alpha\nbeta\ngamma beta\ndelta\nbeta";
+
+    // a last line without newline is a record up to the end of the data
+    CHECK(search_records(log, strlen(log), "beta", 4, 1, &result));
+    CHECK(3 == result.count);
+    CHECK((3 == result.count) && (6 == result.p_matches[0].start) && (11 == result.p_matches[0].end));
+    CHECK((3 == result.count) && (11 == result.p_matches[1].start) && (22 == result.p_matches[1].end));
+    CHECK((3 == result.count) && (28 == result.p_matches[2].start) && (32 == result.p_matches[2].end));
+    CHECK(20 == result.bytes);
+    search_result_destroy(&result);
+
+    CHECK(search_records(log, 0, "beta", 4, 1, &result));
+    CHECK(0 == result.count);
+    search_result_destroy(&result);
+
+    CHECK(search_records(log, strlen(log), "epsilon", 7, 1, &result));
+    CHECK(0 == result.count);
+    search_result_destroy(&result);
+}
+
+static void test_segments(void)
+{
+    struct search_result_s single;
+    struct search_result_s parallel;
+    char * p_data = malloc(SEGMENTED_DATA_LEN);
+    CHECK(NULL != p_data);
+    if (NULL == p_data)
+    {
+        return;
+    }
+
+    // 99 byte records with a newline each, the last record ends the data
+    for (size_t pos = 0; pos < SEGMENTED_DATA_LEN; pos++)
+    {
+        p_data[pos] = ((pos + 1) % 100 == 0) ? '\n' : 'a';
+    }
+    p_data[SEGMENTED_DATA_LEN - 1] = '\n';
+
+    // the record the two segments are split after, with the pattern across
+    // the middle of the data, the first record and the last one
+    const size_t middle = SEGMENTED_DATA_LEN / 2;
+    memcpy(p_data + middle - 1, "xyz", 3);
+    memcpy(p_data + 10, "xyz", 3);
+    memcpy(p_data + SEGMENTED_DATA_LEN - 4, "xyz", 3);
+    const size_t middle_record_start = middle - (middle % 100);
+
+    CHECK(search_records(p_data, SEGMENTED_DATA_LEN, "xyz", 3, 1, &single));
+    CHECK(search_records(p_data, SEGMENTED_DATA_LEN, "xyz", 3, 2, &parallel));
+    CHECK(3 == single.count);
+    CHECK((3 == single.count) && (middle_record_start == single.p_matches[1].start));
+    CHECK((3 == single.count) && (SEGMENTED_DATA_LEN == single.p_matches[2].end));
+    CHECK(single.count == parallel.count);
+    CHECK(single.bytes == parallel.bytes);
+    for (size_t idx = 0; (idx < single.count) && (idx < parallel.count); idx++)
+    {
+        CHECK(single.p_matches[idx].start == parallel.p_matches[idx].start);
+        CHECK(single.p_matches[idx].end == parallel.p_matches[idx].end);
+    }
+    search_result_destroy(&single);
+    search_result_destroy(&parallel);
+
+    // a record right after the split, starting a segment
+    memset(p_data + middle - 1, 'a', 3);
+    const size_t next_record_start = middle_record_start + 100;
+    memcpy(p_data + next_record_start, "xyz", 3);
+    CHECK(search_records(p_data, SEGMENTED_DATA_LEN, "xyz", 3, 2, &parallel));
+    CHECK((3 == parallel.count) && (next_record_start == parallel.p_matches[1].start));
+    search_result_destroy(&parallel);
+
+    free(p_data);
+}
+
+int main(void)
+{
+    test_find_positions();
+    test_records();
+    test_segments();
+    return CHECK_DONE();
+}
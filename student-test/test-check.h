@@ -0,0 +1,26 @@
+/*
+ * @file test-check.h
+ * @brief minimal check macro shared by the userspace checks, counts failures
+ * and keeps going so one run reports every broken boundary
+ */
+#ifndef STUDENT_TEST_CHECK_H
+#define STUDENT_TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failures = 0;
+
+#define CHECK(expr) \
+    do \
+    { \
+        if (!(expr)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_DONE() ((0 == test_failures) ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif /* STUDENT_TEST_CHECK_H */